@@ -19,6 +19,7 @@
 #include "mx_pci.h"
 #include "mx_mmio.h"
 #include "mx_print.h"
+#include "mx_trace.h"
 #include "mx_second_stage_bl_image.h"
 
 #define MX_BOOT_OBJ_NAME "mx_boot"
@@ -255,6 +256,8 @@ int mx_boot_load_image(struct mx_dev *mx_dev, const char *buffer, size_t length,
         mutex_lock(&mx_dev->transfer_lock);
         error = boot_image_transfer(mx_dev, image, chunk_size, boot_now);
         mutex_unlock(&mx_dev->transfer_lock);
+        trace_mx_boot_chunk(mx_dev, length - size_left, chunk_size, length,
+                            boot_now, error);
         if (error) {
             goto error_failed_transfer;
         }
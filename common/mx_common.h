@@ -79,6 +79,7 @@ struct mx_dev {
     struct pci_dev *pci;
     void __iomem *mmio;
     struct mutex transfer_lock;
+    int irq_vectors;
 };
 
 /*
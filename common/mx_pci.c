@@ -100,33 +100,57 @@ void mx_pci_cleanup(struct mx_dev *mx_dev)
 
 int mx_pci_irq_init(struct mx_dev *mx_dev, const char *drv_name,
                     irq_handler_t drv_isr, void *drv_isr_data)
+{
+    return mx_pci_irq_vectors_init(mx_dev, drv_name, &drv_isr, 1, drv_isr_data);
+}
+
+int mx_pci_irq_vectors_init(struct mx_dev *mx_dev, const char *drv_name,
+                            const irq_handler_t *drv_isrs, int nvec,
+                            void *drv_isr_data)
 {
     int irq;
+    int index;
     int error;
 
-    error = pci_alloc_irq_vectors(mx_dev->pci, 1, 1, PCI_IRQ_MSI);
+    /* MSI only: the reset sequence relies on the MSI enable handshake. */
+    error = pci_alloc_irq_vectors(mx_dev->pci, nvec, nvec, PCI_IRQ_MSI);
     if (error < 0) {
-        mx_err("failed to allocate %d MSI vectors - %d\n", 1, error);
+        mx_err("failed to allocate %d MSI vectors - %d\n", nvec, error);
         return error;
     }
 
-    irq = pci_irq_vector(mx_dev->pci, 0);
-    error = request_irq(irq, drv_isr, 0, drv_name, drv_isr_data);
-    if (error) {
-        mx_err("failed to request irqs - %d\n", error);
-        return error;
+    for (index = 0; index < nvec; index++) {
+        irq = pci_irq_vector(mx_dev->pci, index);
+        error = request_irq(irq, drv_isrs[index], 0, drv_name, drv_isr_data);
+        if (error) {
+            mx_err("failed to request irq %d - %d\n", index, error);
+            goto error_request;
+        }
     }
+    mx_dev->irq_vectors = nvec;
 
     return 0;
+
+error_request:
+    while (index--) {
+        free_irq(pci_irq_vector(mx_dev->pci, index), drv_isr_data);
+    }
+    pci_free_irq_vectors(mx_dev->pci);
+
+    return error;
 }
 
 void mx_pci_irq_cleanup(struct mx_dev *mx_dev, void *drv_isr_data)
 {
     int irq;
+    int index;
 
-    irq = pci_irq_vector(mx_dev->pci, 0);
-    synchronize_irq(irq);
-    free_irq(irq, drv_isr_data);
+    for (index = 0; index < mx_dev->irq_vectors; index++) {
+        irq = pci_irq_vector(mx_dev->pci, index);
+        synchronize_irq(irq);
+        free_irq(irq, drv_isr_data);
+    }
+    mx_dev->irq_vectors = 0;
     pci_free_irq_vectors(mx_dev->pci);
 }
 
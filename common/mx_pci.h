@@ -61,6 +61,28 @@ void mx_pci_cleanup(struct mx_dev *mx_dev);
 int mx_pci_irq_init(struct mx_dev *mx_dev, const char *drv_name,
                     irq_handler_t drv_isr, void *drv_isr_data);
 
+/*
+ * @brief Initializes several Myriad X PCI MSI IRQs, one ISR per vector.
+ *
+ * NOTES:
+ *  1. Either all the requested vectors are allocated or none of them is, so
+ *     that the caller can fall back to a smaller vector count.
+ *  2. Vectors are released by mx_pci_irq_cleanup().
+ *
+ * @param[in] mx_dev - pointer to mx_dev instance.
+ * @param[in] drv_name - driver name.
+ * @param[in] drv_isrs - ISRs provided by driver, drv_isrs[n] serves vector n.
+ * @param[in] nvec - number of vectors to allocate.
+ * @param[in] drv_data - Data passed to ISRs when invoked.
+ *
+ * @return:
+ *       0 - success.
+ *      <0 - linux error code.
+ */
+int mx_pci_irq_vectors_init(struct mx_dev *mx_dev, const char *drv_name,
+                            const irq_handler_t *drv_isrs, int nvec,
+                            void *drv_isr_data);
+
 /*
  * @brief Cleanup of Myriad X PCI MSI IRQ.
  *
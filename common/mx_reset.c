@@ -17,6 +17,7 @@
 #include "mx_common.h"
 #include "mx_pci.h"
 #include "mx_print.h"
+#include "mx_trace.h"
 
 /* Time given to MX device to detect and perform reset, in milliseconds.
  * This value may have to be updated if the polling task's period on device side
@@ -54,31 +55,38 @@ int mx_reset_device(struct mx_dev *mx_dev) {
 
     /* Save the device's context because its PCIe controller will be reset in
      * the process. */
+    trace_mx_reset_phase(mx_dev, MX_RESET_PHASE_SAVE, 0);
     mx_pci_dev_ctx_save(mx_dev);
 
     /* Disable the device to put an end to all operations. */
+    trace_mx_reset_phase(mx_dev, MX_RESET_PHASE_DISABLE, 0);
     mx_pci_dev_disable(mx_dev);
 
     /* Ensure there are no transactions pending. */
+    trace_mx_reset_phase(mx_dev, MX_RESET_PHASE_DRAIN, 0);
     mx_pci_wait_for_pending_transaction(mx_dev);
 
     /* Write the magic into Vendor Specific DLLP register to trigger the device
      * reset. */
+    trace_mx_reset_phase(mx_dev, MX_RESET_PHASE_TRIGGER, 0);
     pci_write_config_dword(mx_dev->pci, MX_VENDOR_SPEC_DLLP, MX_RESET_DEV);
 
     /* Give some time to the device to trigger and complete the reset. */
+    trace_mx_reset_phase(mx_dev, MX_RESET_PHASE_WAIT, 0);
     msleep(MX_DEV_RESET_TIME_MS);
 
     /* Check that the device is up again before restoring the full PCI context. */
     if (!mx_pci_dev_id_valid(mx_dev)) {
-        return -EIO;
+        error = -EIO;
+        goto done;
     }
 
     /* Restore the full PCI context and check the device is up and running. */
+    trace_mx_reset_phase(mx_dev, MX_RESET_PHASE_RESTORE, 0);
     error = mx_reset_restore_and_check_device(mx_dev);
-    if (error) {
-        return error;
-    }
 
-    return 0;
+done:
+    trace_mx_reset_phase(mx_dev, MX_RESET_PHASE_DONE, error);
+
+    return error;
 }
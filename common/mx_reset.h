@@ -15,6 +15,17 @@
 
 #include "mx_common.h"
 
+/* Steps of mx_reset_device(), reported through the mx_reset_phase tracepoint */
+enum mx_reset_phase {
+    MX_RESET_PHASE_SAVE,
+    MX_RESET_PHASE_DISABLE,
+    MX_RESET_PHASE_DRAIN,
+    MX_RESET_PHASE_TRIGGER,
+    MX_RESET_PHASE_WAIT,
+    MX_RESET_PHASE_RESTORE,
+    MX_RESET_PHASE_DONE
+};
+
 /*
  * @brief Reset MX device
  *
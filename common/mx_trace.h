@@ -0,0 +1,106 @@
+/*******************************************************************************
+ *
+ * MX device boot and reset tracepoints
+ *
+ * Copyright (C) 2019 Intel Corporation
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ ******************************************************************************/
+
+/*
+ * This code is linked into several modules, each registers the events under
+ * its own system (mxlk:mx_boot_chunk, mxbl:mx_boot_chunk, ...) through
+ * MX_TRACE_SYSTEM, set by the module Makefile.
+ */
+#ifndef MX_TRACE_SYSTEM
+#define MX_TRACE_SYSTEM mx
+#endif
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM MX_TRACE_SYSTEM
+
+#if !defined(COMMON_MX_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define COMMON_MX_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/pci.h>
+
+#include "mx_common.h"
+#include "mx_reset.h"
+
+TRACE_DEFINE_ENUM(MX_RESET_PHASE_SAVE);
+TRACE_DEFINE_ENUM(MX_RESET_PHASE_DISABLE);
+TRACE_DEFINE_ENUM(MX_RESET_PHASE_DRAIN);
+TRACE_DEFINE_ENUM(MX_RESET_PHASE_TRIGGER);
+TRACE_DEFINE_ENUM(MX_RESET_PHASE_WAIT);
+TRACE_DEFINE_ENUM(MX_RESET_PHASE_RESTORE);
+TRACE_DEFINE_ENUM(MX_RESET_PHASE_DONE);
+
+#define show_mx_reset_phase(phase)                     \
+    __print_symbolic(phase,                            \
+        { MX_RESET_PHASE_SAVE,    "save" },            \
+        { MX_RESET_PHASE_DISABLE, "disable" },         \
+        { MX_RESET_PHASE_DRAIN,   "drain" },           \
+        { MX_RESET_PHASE_TRIGGER, "trigger" },         \
+        { MX_RESET_PHASE_WAIT,    "wait" },            \
+        { MX_RESET_PHASE_RESTORE, "restore" },         \
+        { MX_RESET_PHASE_DONE,    "done" })
+
+/* One chunk of a boot image sent to the device, after its transfer */
+TRACE_EVENT(mx_boot_chunk,
+    TP_PROTO(struct mx_dev *mx_dev, size_t offset, size_t length,
+             size_t total, int boot_now, int error),
+    TP_ARGS(mx_dev, offset, length, total, boot_now, error),
+    TP_STRUCT__entry(
+        __field(u8, bus)
+        __field(u8, devfn)
+        __field(size_t, offset)
+        __field(size_t, length)
+        __field(size_t, total)
+        __field(int, boot_now)
+        __field(int, error)
+    ),
+    TP_fast_assign(
+        __entry->bus = mx_dev->pci->bus->number;
+        __entry->devfn = mx_dev->pci->devfn;
+        __entry->offset = offset;
+        __entry->length = length;
+        __entry->total = total;
+        __entry->boot_now = boot_now;
+        __entry->error = error;
+    ),
+    TP_printk("dev=%02x:%02x.%d offset=%zu length=%zu total=%zu boot=%d "
+              "error=%d", __entry->bus, PCI_SLOT(__entry->devfn),
+              PCI_FUNC(__entry->devfn), __entry->offset, __entry->length,
+              __entry->total, __entry->boot_now, __entry->error)
+);
+
+/* Start of a reset phase, or end of the reset with its result */
+TRACE_EVENT(mx_reset_phase,
+    TP_PROTO(struct mx_dev *mx_dev, int phase, int error),
+    TP_ARGS(mx_dev, phase, error),
+    TP_STRUCT__entry(
+        __field(u8, bus)
+        __field(u8, devfn)
+        __field(int, phase)
+        __field(int, error)
+    ),
+    TP_fast_assign(
+        __entry->bus = mx_dev->pci->bus->number;
+        __entry->devfn = mx_dev->pci->devfn;
+        __entry->phase = phase;
+        __entry->error = error;
+    ),
+    TP_printk("dev=%02x:%02x.%d phase=%s error=%d", __entry->bus,
+              PCI_SLOT(__entry->devfn), PCI_FUNC(__entry->devfn),
+              show_mx_reset_phase(__entry->phase), __entry->error)
+);
+
+#endif /* COMMON_MX_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mx_trace
+#include <trace/define_trace.h>
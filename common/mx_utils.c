@@ -13,6 +13,10 @@
 #include "mx_common.h"
 #include "mx_mmio.h"
 
+/* Instantiates the boot and reset tracepoints for the module */
+#define CREATE_TRACE_POINTS
+#include "mx_trace.h"
+
 /* Functions defined in this file are exported through mx_common.h */
 
 enum mx_opmode mx_get_opmode(struct mx_dev *mx_dev)
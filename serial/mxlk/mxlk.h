@@ -25,18 +25,28 @@
 #include <linux/dma-mapping.h>
 #include <linux/cache.h>
 #include <linux/wait.h>
+#include <linux/uio.h>
+#include <linux/completion.h>
+#include <linux/scatterlist.h>
+#include <linux/percpu.h>
+#include <linux/kthread.h>
 
 #include "mx_common.h"
 #include "mx_mmio.h"
 #include "mx_print.h"
 
 #include "mxlk_common.h"
+#include "mxlk_ring.h"
+#include "mxlk_stats.h"
+#include "mxlk_latency.h"
 
 #define MXLK_MAX_DEVICES    (8)
 #define MXLK_DRIVER_NAME    "mxlk"
 #define MXLK_DRIVER_DESC    "Intel(R) MyriadX PCIe xLink"
 #define MXLK_MAX_NAME_LEN   (32)
 
+#define MXLK_MMIO_BAR       (2)
+
 #define MXLK_TO_PCI(mxlk) ((mxlk)->pci)
 #define MXLK_TO_DEV(mxlk) (&(mxlk)->pci->dev)
 
@@ -45,16 +55,55 @@ struct mxlk_pipe {
     u32 ndesc;
     u32 *head;
     u32 *tail;
+    u32 shadow;         /* last value of the host owned TX tail / RX head */
     struct mxlk_transfer_desc *tdr;
+    struct mxlk_transfer_desc *tdr_wc;  /* write-combined alias, or tdr */
+    bool host;          /* tdr is coherent host memory at phys, not MMIO */
+    dma_addr_t phys;
+    bool packed;        /* ownership bits instead of head/tail */
+    bool avail_wrap;    /* packed wrap counter of the next descriptor posted */
+    bool used_wrap;     /* packed wrap counter of the next descriptor reaped */
+};
+
+/*
+ * Zero-copy write in flight: user pages pinned and mapped for the whole write,
+ * released once every TX descriptor pointing into them has been reaped and
+ * the writer has left
+ */
+struct mxlk_zc {
+    struct page **pages;
+    int npages;
+    struct sg_table sgt;
+    int nents;              /* entries returned by dma_map_sg */
+    atomic_t pending;       /* bds not yet reaped */
+    atomic_t refs;          /* the writer, and its bds as a whole */
+    int error;
 };
 
 struct mxlk_buf_desc {
     struct mxlk_buf_desc *next;
-    void  *head;
+    void  *head;        /* page_address(page) + offset of the buffer */
+    struct page *page;  /* backing page, holds one reference */
     size_t true_len;
     void  *data;
     size_t length;
     int interface;
+    dma_addr_t phys;    /* streaming mapping of head, held for bd lifetime */
+    int direction;
+    struct mxlk_zc *zc; /* set if data lives in pinned user pages */
+    u64 stamp;          /* ns, write() entry for TX, RX reap for RX */
+    u64 posted;         /* ns, TX descriptor post */
+    u16 flags;          /* MXLK_DESC_FLAG_* of the descriptor */
+    size_t msg_len;     /* bytes of the read record this bd starts */
+};
+
+/*
+ * Chain of bds linked through next, with O(1) append and splice
+ */
+struct mxlk_bd_list {
+    struct mxlk_buf_desc *head;
+    struct mxlk_buf_desc *tail;
+    int count;
 };
 
 struct mxlk_dma_desc {
@@ -66,16 +115,72 @@ struct mxlk_dma_desc {
 struct mxlk_stream {
     int busy;
     size_t frag;
+    struct mutex lock;      /* serializes ring processing */
     struct mxlk_pipe pipe;
     struct mxlk_dma_desc *ddr;
+    struct mxlk_transfer_desc *stage;   /* host copy of descriptors to write,
+                                           the ring itself if pipe.host */
 };
 
-struct mxlk_list {
-    spinlock_t lock;
-    size_t bytes;
-    size_t buffers;
-    struct mxlk_buf_desc *head;
-    struct mxlk_buf_desc *tail;
+/*
+ * Per CPU magazine of free bds in front of a shared pool: allocs and frees
+ * stay on the CPU and reach the shared ring only once per batch
+ */
+#define MXLK_BD_CACHE_SIZE  (32)
+
+struct mxlk_bd_cache {
+    int count;
+    struct mxlk_buf_desc *bds[MXLK_BD_CACHE_SIZE];
+};
+
+/*
+ * Pool of DMA-mapped bds, resized at runtime between min and max bds
+ * NOTES:
+ *  1) grown by the resize work when an alloc finds it empty or the shared
+ *     ring runs below 1/8 of the pool, shrunk back towards min while more
+ *     than half of it stays unused
+ *  2) the ring is allocated for the max set at init, max can be lowered
+ *     through sysfs and raised back up to that capacity
+ */
+struct mxlk_pool {
+    struct mxlk *mxlk;
+    int direction;
+    struct mxlk_ring ring;
+    struct mxlk_bd_cache __percpu *caches;  /* NULL if pool too small */
+    int cache_size;     /* max bds held by one CPU */
+    int batch;          /* bds moved between a cache and the ring at once */
+    atomic_t total;     /* bds owned by the pool, free or in use */
+    int floor;          /* lowest min allowed */
+    int min;
+    int max;
+    atomic_t grow;      /* grow requested since last resize run */
+    int idle_runs;      /* consecutive resize runs with most bds unused */
+    struct delayed_work resize;
+    struct page *frag_page;     /* page being carved into small buffers */
+    unsigned int frag_offset;
+};
+
+/*
+ * TX/RX ring pair with its own pending write queues and work items
+ * NOTES:
+ *  1) each interface has its own write queue, served onto the TX ring by
+ *     strict priority first, then deficit round robin within a priority
+ */
+struct mxlk_queue {
+    int id;
+    struct mxlk *mxlk;
+    struct mxlk_stream tx;
+    struct mxlk_stream rx;
+    /* One producer per interface only because every writer of an interface
+     * holds its wlock, the TX lock makes the single consumer */
+    struct mxlk_spsc write[MXLK_NUM_INTERFACES];
+    size_t deficit[MXLK_NUM_INTERFACES];    /* DRR credit, in bytes */
+    int drr_next;                           /* interface served next */
+    struct work_struct rx_event;
+    struct work_struct tx_event;
+    struct kthread_work rx_kwork;   /* rx_event on the service thread */
+    struct kthread_work tx_kwork;   /* tx_event on the service thread */
+    struct mxlk_pcpu_queue_stats __percpu *stats;
 };
 
 struct mxlk_interface {
@@ -86,21 +191,53 @@ struct mxlk_interface {
     struct device *dev;
     struct mutex rlock;
     struct mutex wlock;
-    struct mxlk_list read;
+    struct mxlk_ring read;      /* pushed by RX queues, popped by reader */
     struct mxlk_buf_desc *partial_read;
     wait_queue_head_t rd_waitq;
+    unsigned int busy_poll;     /* usecs, set through sysfs */
+    int fd_busy_poll;           /* usecs, set through ioctl, <0 if unset */
+    int txq;                    /* TX queue currently used by the interface */
+    /* only used once there are more interfaces, see mxlk_tx_dequeue() */
+    unsigned int tx_weight;     /* DRR quantum, in fragments, 0 counts as 1 */
+    unsigned int tx_priority;   /* higher is served first, < MXLK_TX_PRIORITIES */
+    atomic_t tx_inflight;       /* bds queued on txq and not yet reaped */
+    atomic_t read_bytes;        /* bytes queued for read, partial_read included */
+    atomic_t read_msgs;         /* records queued: messages and unflagged bds */
+    struct mxlk_bd_list rx_msg; /* message being received, under its RX lock */
+    bool rx_msg_drop;           /* dropping the rest of an oversized message */
+    bool datagram;              /* one message per read and write */
+    struct mxlk_buf_desc *tx_pending;   /* partly filled fragment, wlock */
+    unsigned int coalesce;      /* usecs tx_pending may wait, 0 disables */
+    struct delayed_work flush;  /* sends tx_pending once coalesce expires */
+    unsigned int rcvtimeo;      /* msecs a blocking read waits, 0 forever */
+    unsigned int sndtimeo;      /* msecs a blocking write waits, 0 forever */
+    unsigned int rcvlowat;      /* bytes queued before a reader wakes, 0 as 1 */
+    unsigned int rcvwant;       /* wake threshold of the blocked read, or 0 */
+    unsigned int sndlowat;      /* free TX bytes before a writer wakes, 0 as 1 */
+    struct mxlk_pcpu_latency __percpu *latency;
+    struct mxlk_latency_hist *latency_base;    /* totals at last reset */
+    struct mxlk_latency_hist *latency_snap;    /* read scratch, stats_lock */
 };
 
-struct mxlk_stats {
-    struct {
-        size_t pkts;
-        size_t bytes;
-    }tx_krn, rx_krn, tx_usr, rx_usr;
-    size_t doorbells;
-    size_t interrupts;
-    size_t rx_event_runs;
-    size_t tx_event_runs;
-};
+/*
+ * Bits of mxlk poll_state
+ */
+#define MXLK_POLL_SCHED     (0) /* poll queued or running, data irqs masked */
+#define MXLK_POLL_SPLIT_IRQ (1) /* masked irqs are the RX and TX vectors */
+
+/*
+ * Number of TX priority levels of interfaces
+ */
+#define MXLK_TX_PRIORITIES  (8)
+
+/*
+ * TX queue selection policies
+ * NOTES:
+ *  1) per interface selection keeps all traffic on queue 0 as long as
+ *     MXLK_NUM_INTERFACES is 1
+ */
+#define MXLK_QUEUE_SELECT_CPU       (0) /* queue of the submitting CPU */
+#define MXLK_QUEUE_SELECT_INTERFACE (1) /* queue fixed per interface */
 
 struct mxlk {
     int status;
@@ -119,21 +256,46 @@ struct mxlk {
 
     size_t fragment_size;
     struct mxlk_cap_txrx *txrx;
-    struct mxlk_stream tx;
-    struct mxlk_stream rx;
+    struct mxlk_cap_txrx_ext *txrx_ext;
+    struct mxlk_cap_txrx_host *txrx_host;   /* set if rings in host memory */
+    bool host_rings_held;   /* device kept host rings at cleanup, leak them */
+    u32 features;           /* MXLK_TXRX_FEATURE_* enabled for the link */
+    bool packed;            /* packed ring format, set by the version check */
+    struct mxlk_queue queues[MXLK_MAX_QUEUES];
+    int num_queues;         /* queues in use, 0 while comms are down */
+    int queue_select;       /* MXLK_QUEUE_SELECT_* */
 
-    struct mxlk_list write;
-    struct mxlk_list rx_pool;
-    struct mxlk_list tx_pool;
+    struct mxlk_pool rx_pool;
+    struct mxlk_pool tx_pool;
+    int msg_max_bds;        /* fragments of the largest datagram message */
     wait_queue_head_t wr_waitq;
 
-    struct work_struct rx_event;
-    struct work_struct tx_event;
+    struct work_struct status_event;
     struct work_struct send_doorbell;
+    int irqs[MXLK_IRQ_VECTORS_MAX]; /* linux irq of each MSI vector in use */
+
+    struct work_struct poll;
+    struct kthread_work poll_kwork; /* poll on the service thread */
+    unsigned long poll_state;
+    int poll_mode;          /* service rings from mxlk poll instead of irqs */
+    int poll_budget;        /* max descriptors per ring per poll run */
+
+    struct kthread_worker *service; /* services the rings instead of wq */
+    int service_priority;           /* SCHED_FIFO priority, 0 if normal */
+    struct cpumask service_cpus;    /* set through sysfs, empty if never */
+
+    size_t zc_threshold;    /* min write length sent zero-copy, 0 disables */
 
-    struct device_attribute debug;
-    struct mxlk_stats stats;
-    struct mxlk_stats stats_old;
+    struct mxlk_pcpu_stats __percpu *stats;
+    struct mxlk_stats_files *stats_files;   /* sysfs export */
+    struct dentry *debugfs;                 /* latency histograms */
+    struct mutex stats_lock;                /* protects the debug/latency bases */
+    u64 stats_base[MXLK_STAT_NUM];          /* debug counts start from here */
+    u64 interrupts_base;
+    u64 queue_stats_base[MXLK_MAX_QUEUES][MXLK_QSTAT_NUM];
+    struct mxlk_cap_stats *cap_stats;       /* device counters, or NULL */
+    int cap_stats_num;                      /* counters the device keeps */
+    u64 dev_stats_base[MXLK_DSTAT_NUM];
 
     struct mx_dev mx_dev;
 };
@@ -0,0 +1,276 @@
+/*******************************************************************************
+ *
+ * Intel Myriad-X PCIe Serial Driver: Buffer descriptor queue microbenchmark
+ *
+ * Copyright (C) 2018 - 2019 Intel Corporation
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ ******************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/completion.h>
+#include <linux/spinlock.h>
+
+#include "mxlk.h"
+#include "mxlk_bench.h"
+
+#define MXLK_BENCH_OPS           (1 << 20)  /* transfers per producer */
+#define MXLK_BENCH_BDS           (256)      /* bds cycling through a run */
+#define MXLK_BENCH_MAX_PRODUCERS (4)
+
+enum mxlk_bench_type {
+    MXLK_BENCH_LIST,    /* spinlocked list, as used before the rings */
+    MXLK_BENCH_SPSC,
+    MXLK_BENCH_RING,
+};
+
+static const char *mxlk_bench_names[] = {"list", "spsc", "ring"};
+
+struct mxlk_bench_list {
+    spinlock_t lock;
+    struct mxlk_buf_desc *head;
+    struct mxlk_buf_desc *tail;
+};
+
+struct mxlk_bench_queue {
+    enum mxlk_bench_type type;
+    union {
+        struct mxlk_bench_list list;
+        struct mxlk_spsc spsc;
+        struct mxlk_ring ring;
+    };
+};
+
+/*
+ * Producers move bds from the free queue to the work queue, the consumer moves
+ * them back: the same pool and queue round trip as the driver data path
+ */
+struct mxlk_bench {
+    int producers;
+    struct mxlk_bench_queue work;
+    struct mxlk_bench_queue free;
+    struct completion start;
+};
+
+struct mxlk_bench_thread {
+    struct mxlk_bench *bench;
+    struct completion done;
+};
+
+static int mxlk_bench_queue_init(struct mxlk_bench_queue *q,
+                                 enum mxlk_bench_type type, size_t size)
+{
+    q->type = type;
+
+    switch (type) {
+        case MXLK_BENCH_LIST:
+            spin_lock_init(&q->list.lock);
+            q->list.head = NULL;
+            q->list.tail = NULL;
+            return 0;
+        case MXLK_BENCH_SPSC:
+            return mxlk_spsc_init(&q->spsc, size);
+        case MXLK_BENCH_RING:
+            return mxlk_ring_init(&q->ring, size);
+    }
+
+    return -EINVAL;
+}
+
+static void mxlk_bench_queue_cleanup(struct mxlk_bench_queue *q)
+{
+    switch (q->type) {
+        case MXLK_BENCH_LIST:
+            break;
+        case MXLK_BENCH_SPSC:
+            mxlk_spsc_cleanup(&q->spsc);
+            break;
+        case MXLK_BENCH_RING:
+            mxlk_ring_cleanup(&q->ring);
+            break;
+    }
+}
+
+static void mxlk_bench_push(struct mxlk_bench_queue *q,
+                            struct mxlk_buf_desc *bd)
+{
+    switch (q->type) {
+        case MXLK_BENCH_LIST:
+            bd->next = NULL;
+            spin_lock(&q->list.lock);
+            if (q->list.tail) {
+                q->list.tail->next = bd;
+            } else {
+                q->list.head = bd;
+            }
+            q->list.tail = bd;
+            spin_unlock(&q->list.lock);
+            break;
+        case MXLK_BENCH_SPSC:
+            /* queues hold all bds, push cannot fail */
+            mxlk_spsc_push(&q->spsc, bd);
+            break;
+        case MXLK_BENCH_RING:
+            mxlk_ring_push(&q->ring, bd);
+            break;
+    }
+}
+
+static struct mxlk_buf_desc *mxlk_bench_pop(struct mxlk_bench_queue *q)
+{
+    struct mxlk_buf_desc *bd = NULL;
+
+    switch (q->type) {
+        case MXLK_BENCH_LIST:
+            spin_lock(&q->list.lock);
+            bd = q->list.head;
+            if (bd) {
+                q->list.head = bd->next;
+                if (!q->list.head) {
+                    q->list.tail = NULL;
+                }
+            }
+            spin_unlock(&q->list.lock);
+            break;
+        case MXLK_BENCH_SPSC:
+            bd = mxlk_spsc_pop(&q->spsc);
+            break;
+        case MXLK_BENCH_RING:
+            bd = mxlk_ring_pop(&q->ring);
+            break;
+    }
+
+    return bd;
+}
+
+static int mxlk_bench_producer(void *args)
+{
+    struct mxlk_bench_thread *thread = args;
+    struct mxlk_bench *bench = thread->bench;
+    struct mxlk_buf_desc *bd;
+    int count = 0;
+
+    wait_for_completion(&bench->start);
+    while (count < MXLK_BENCH_OPS) {
+        bd = mxlk_bench_pop(&bench->free);
+        if (!bd) {
+            cond_resched();
+            continue;
+        }
+        mxlk_bench_push(&bench->work, bd);
+        count++;
+    }
+    complete(&thread->done);
+
+    return 0;
+}
+
+static int mxlk_bench_consumer(void *args)
+{
+    struct mxlk_bench_thread *thread = args;
+    struct mxlk_bench *bench = thread->bench;
+    struct mxlk_buf_desc *bd;
+    long count = 0;
+
+    wait_for_completion(&bench->start);
+    while (count < (long) MXLK_BENCH_OPS * bench->producers) {
+        bd = mxlk_bench_pop(&bench->work);
+        if (!bd) {
+            cond_resched();
+            continue;
+        }
+        mxlk_bench_push(&bench->free, bd);
+        count++;
+    }
+    complete(&thread->done);
+
+    return 0;
+}
+
+static void mxlk_bench_case(enum mxlk_bench_type type, int producers,
+                            struct mxlk_buf_desc *bds)
+{
+    int index, started = 0;
+    u64 start, elapsed, ops;
+    struct mxlk_bench bench;
+    struct mxlk_bench_thread threads[MXLK_BENCH_MAX_PRODUCERS + 1];
+    struct task_struct *task;
+
+    init_completion(&bench.start);
+
+    if (mxlk_bench_queue_init(&bench.work, type, MXLK_BENCH_BDS)) {
+        goto error_work;
+    }
+    if (mxlk_bench_queue_init(&bench.free, type, MXLK_BENCH_BDS)) {
+        goto error_free;
+    }
+    for (index = 0; index < MXLK_BENCH_BDS; index++) {
+        mxlk_bench_push(&bench.free, bds + index);
+    }
+
+    /* Thread 0 consumes, the others produce */
+    for (index = 0; index <= producers; index++) {
+        threads[index].bench = &bench;
+        init_completion(&threads[index].done);
+        task = kthread_run(index ? mxlk_bench_producer : mxlk_bench_consumer,
+                           &threads[index], "mxlk_bench/%d", index);
+        if (IS_ERR(task)) {
+            mx_err("failed to start bench thread %d\n", index);
+            break;
+        }
+        started++;
+    }
+
+    /* Run with whatever started, the consumer only waits for those */
+    bench.producers = max(started - 1, 0);
+
+    start = ktime_get_ns();
+    complete_all(&bench.start);
+    for (index = 0; index < started; index++) {
+        wait_for_completion(&threads[index].done);
+    }
+    elapsed = max_t(u64, ktime_get_ns() - start, 1);
+
+    if (bench.producers) {
+        ops = div64_u64((u64) MXLK_BENCH_OPS * bench.producers * NSEC_PER_SEC,
+                        elapsed);
+        mx_info("bench %-4s %dP1C: %llu ops/s (%llu ns)\n",
+                mxlk_bench_names[type], bench.producers, ops, elapsed);
+    }
+
+    mxlk_bench_queue_cleanup(&bench.free);
+error_free:
+    mxlk_bench_queue_cleanup(&bench.work);
+error_work:
+    return;
+}
+
+void mxlk_bench_run(void)
+{
+    struct mxlk_buf_desc *bds;
+    int producers;
+
+    bds = kcalloc(MXLK_BENCH_BDS, sizeof(*bds), GFP_KERNEL);
+    if (!bds) {
+        mx_err("failed to alloc bench buf descs\n");
+        return;
+    }
+
+    /* Leave a CPU to the consumer */
+    producers = clamp(num_online_cpus() - 1, 1, MXLK_BENCH_MAX_PRODUCERS);
+
+    mxlk_bench_case(MXLK_BENCH_LIST, 1, bds);
+    mxlk_bench_case(MXLK_BENCH_SPSC, 1, bds);
+    mxlk_bench_case(MXLK_BENCH_RING, 1, bds);
+    if (producers > 1) {
+        mxlk_bench_case(MXLK_BENCH_LIST, producers, bds);
+        mxlk_bench_case(MXLK_BENCH_RING, producers, bds);
+    }
+
+    kfree(bds);
+}
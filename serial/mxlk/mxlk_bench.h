@@ -0,0 +1,24 @@
+/*******************************************************************************
+ *
+ * Intel Myriad-X PCIe Serial Driver: Buffer descriptor queue microbenchmark
+ *
+ * Copyright (C) 2018 - 2019 Intel Corporation
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ ******************************************************************************/
+
+#ifndef SERIAL_MXLK_MXLK_BENCH_H_
+#define SERIAL_MXLK_MXLK_BENCH_H_
+
+/*
+ * @brief measures ops/sec of the lock-free bd queues against the spinlocked
+ *        list they replaced, results are reported through info logs
+ *
+ * NOTES:
+ *  1) only built with MXLK_BENCH=1, runs once at module load
+ *
+ */
+void mxlk_bench_run(void);
+
+#endif /* SERIAL_MXLK_MXLK_BENCH_H_ */
@@ -14,6 +14,7 @@
 #include <linux/uaccess.h>
 #include <linux/mutex.h>
 #include <linux/poll.h>
+#include <linux/uio.h>
 
 #include "mxlk_char.h"
 #include "mxlk_core.h"
@@ -36,6 +37,9 @@ static int mxlk_dev_open(struct inode *inode, struct file *filp)
                                               struct mxlk_interface, cdev);
     filp->private_data = inf;
 
+    /* read/write_iter honour IOCB_NOWAIT, so io_uring need not punt to a worker */
+    filp->f_mode |= FMODE_NOWAIT;
+
     return mxlk_core_open(inf);
 }
 
@@ -48,20 +52,20 @@ static int mxlk_dev_release(struct inode *inode, struct file *filp)
     return mxlk_core_close(inf);
 }
 
-static ssize_t mxlk_dev_read(struct file *filp, char *buffer,
-                             size_t len, loff_t *offset)
+static ssize_t mxlk_dev_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-    struct mxlk_interface *inf = priv_to_interface(filp);
+    struct mxlk_interface *inf = priv_to_interface(iocb->ki_filp);
 
-    return mxlk_core_read(inf, (void *) buffer, len);
+    return mxlk_core_read(inf, to, (iocb->ki_flags & IOCB_NOWAIT) ||
+                                   (iocb->ki_filp->f_flags & O_NONBLOCK));
 }
 
-static ssize_t mxlk_dev_write(struct file *filp, const char *buffer,
-                              size_t len, loff_t *offset)
+static ssize_t mxlk_dev_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-    struct mxlk_interface *inf = priv_to_interface(filp);
+    struct mxlk_interface *inf = priv_to_interface(iocb->ki_filp);
 
-    return mxlk_core_write(inf, (void *) buffer, len);
+    return mxlk_core_write(inf, from, (iocb->ki_flags & IOCB_NOWAIT) ||
+                                      (iocb->ki_filp->f_flags & O_NONBLOCK));
 }
 
 static unsigned int mxlk_dev_poll(struct file *filp,
@@ -78,7 +82,7 @@ static unsigned int mxlk_dev_poll(struct file *filp,
        mask |= POLLIN | POLLRDNORM;
     }
 
-    if (mxlk_core_write_buffer_available(inf->mxlk)) {
+    if (mxlk_core_write_buffer_available(inf)) {
        mask |= POLLOUT | POLLWRNORM;
     }
 
@@ -91,6 +95,8 @@ static long mxlk_dev_ioctl(struct file *filp, unsigned int cmd,
     struct mxlk_interface *inf = priv_to_interface(filp);
     struct mxlk_boot_param boot_param;
     enum mxlk_fw_status fw_status = MXLK_FW_STATUS_USER_APP;
+    unsigned int usecs;
+    unsigned int value;
     char enumtoStr[][256] = {{"BOOTLOADER"},
                              {"USER_APPLICATION"},
                              {"UNKNOWN_STATE"}};
@@ -116,18 +122,174 @@ static long mxlk_dev_ioctl(struct file *filp, unsigned int cmd,
                 mx_err("failed to copy to user %d/%zu\n", error, sizeof(fw_status));
             }
             return 0;
+        case MXLK_SET_BUSY_POLL:
+            error = copy_from_user(&usecs, (unsigned int *)arg, sizeof(usecs));
+            if (error) {
+                mx_err("failed to copy from user %d/%zu\n", error, sizeof(usecs));
+                return -EFAULT;
+            }
+            mxlk_core_set_busy_poll(inf, usecs);
+            return 0;
+        case MXLK_SET_RCVTIMEO:
+        case MXLK_SET_SNDTIMEO:
+        case MXLK_SET_RCVLOWAT:
+        case MXLK_SET_SNDLOWAT:
+            error = copy_from_user(&value, (unsigned int *)arg, sizeof(value));
+            if (error) {
+                mx_err("failed to copy from user %d/%zu\n", error, sizeof(value));
+                return -EFAULT;
+            }
+            if (cmd == MXLK_SET_RCVTIMEO || cmd == MXLK_SET_SNDTIMEO) {
+                mxlk_core_set_timeout(inf, cmd == MXLK_SET_SNDTIMEO, value);
+            } else {
+                mxlk_core_set_lowat(inf, cmd == MXLK_SET_SNDLOWAT, value);
+            }
+            return 0;
+        case MXLK_SET_DATAGRAM:
+            error = copy_from_user(&value, (unsigned int *)arg, sizeof(value));
+            if (error) {
+                mx_err("failed to copy from user %d/%zu\n", error, sizeof(value));
+                return -EFAULT;
+            }
+            return mxlk_core_set_datagram(inf, value != 0);
+        case MXLK_SET_COALESCE:
+            error = copy_from_user(&value, (unsigned int *)arg, sizeof(value));
+            if (error) {
+                mx_err("failed to copy from user %d/%zu\n", error, sizeof(value));
+                return -EFAULT;
+            }
+            mxlk_core_set_coalesce(inf, value);
+            return 0;
+        case MXLK_FLUSH:
+            mxlk_core_flush(inf);
+            return 0;
         default:
             mx_err("wrong ioctl command (0x%x)\n", cmd);
             return -EPERM;
     }
 }
 
+static ssize_t mxlk_busy_poll_show(struct device *dev,
+                                   struct device_attribute *attr, char *buf)
+{
+    struct mxlk_interface *inf = dev_get_drvdata(dev);
+
+    return scnprintf(buf, PAGE_SIZE, "%u\n", inf->busy_poll);
+}
+
+static ssize_t mxlk_busy_poll_store(struct device *dev,
+                                    struct device_attribute *attr,
+                                    const char *buf, size_t count)
+{
+    struct mxlk_interface *inf = dev_get_drvdata(dev);
+    unsigned int usecs;
+    int error;
+
+    error = kstrtouint(buf, 0, &usecs);
+    if (error) {
+        return error;
+    }
+
+    inf->busy_poll = usecs;
+
+    return count;
+}
+
+/* TX scheduling only arbitrates between interfaces, with a single one there
+ * is nothing to tune and the files are left out */
+#if MXLK_NUM_INTERFACES > 1
+static ssize_t mxlk_tx_weight_show(struct device *dev,
+                                   struct device_attribute *attr, char *buf)
+{
+    struct mxlk_interface *inf = dev_get_drvdata(dev);
+
+    return scnprintf(buf, PAGE_SIZE, "%u\n", max(inf->tx_weight, 1U));
+}
+
+static ssize_t mxlk_tx_weight_store(struct device *dev,
+                                    struct device_attribute *attr,
+                                    const char *buf, size_t count)
+{
+    struct mxlk_interface *inf = dev_get_drvdata(dev);
+    unsigned int weight;
+    int error;
+
+    error = kstrtouint(buf, 0, &weight);
+    if (error) {
+        return error;
+    }
+    if (!weight || (weight > 1024)) {
+        return -EINVAL;
+    }
+
+    inf->tx_weight = weight;
+
+    return count;
+}
+
+static ssize_t mxlk_tx_priority_show(struct device *dev,
+                                     struct device_attribute *attr, char *buf)
+{
+    struct mxlk_interface *inf = dev_get_drvdata(dev);
+
+    return scnprintf(buf, PAGE_SIZE, "%u\n", inf->tx_priority);
+}
+
+static ssize_t mxlk_tx_priority_store(struct device *dev,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count)
+{
+    struct mxlk_interface *inf = dev_get_drvdata(dev);
+    unsigned int priority;
+    int error;
+
+    error = kstrtouint(buf, 0, &priority);
+    if (error) {
+        return error;
+    }
+    if (priority >= MXLK_TX_PRIORITIES) {
+        return -EINVAL;
+    }
+
+    inf->tx_priority = priority;
+
+    return count;
+}
+#endif
+
+static DEVICE_ATTR(busy_poll, S_IWUSR | S_IRUGO, mxlk_busy_poll_show,
+                   mxlk_busy_poll_store);
+#if MXLK_NUM_INTERFACES > 1
+static DEVICE_ATTR(tx_weight, S_IWUSR | S_IRUGO, mxlk_tx_weight_show,
+                   mxlk_tx_weight_store);
+static DEVICE_ATTR(tx_priority, S_IWUSR | S_IRUGO, mxlk_tx_priority_show,
+                   mxlk_tx_priority_store);
+#endif
+
+static struct attribute *mxlk_inf_attrs[] = {
+    &dev_attr_busy_poll.attr,
+#if MXLK_NUM_INTERFACES > 1
+    &dev_attr_tx_weight.attr,
+    &dev_attr_tx_priority.attr,
+#endif
+    NULL
+};
+
+static const struct attribute_group mxlk_inf_group = {
+    .attrs = mxlk_inf_attrs,
+};
+
+static const struct attribute_group *mxlk_inf_groups[] = {
+    &mxlk_inf_group,
+    NULL
+};
+
 static struct file_operations mxlk_chrdev_fops = {
     .owner   = THIS_MODULE,
     .open    = mxlk_dev_open,
     .release = mxlk_dev_release,
-    .read    = mxlk_dev_read,
-    .write   = mxlk_dev_write,
+    .read_iter  = mxlk_dev_read_iter,
+    .write_iter = mxlk_dev_write_iter,
     .poll    = mxlk_dev_poll,
     .unlocked_ioctl = mxlk_dev_ioctl,
 };
@@ -145,8 +307,9 @@ int mxlk_chrdev_add(struct mxlk_interface *i)
                   (i->mxlk->unit * MXLK_NUM_INTERFACES) + i->id);
 
     /* register the device driver */
-    i->dev = device_create(mxlk_class, NULL, devno, i, "%s:%d",
-                           i->mxlk->name, i->id);
+    i->dev = device_create_with_groups(mxlk_class, NULL, devno, i,
+                                       mxlk_inf_groups, "%s:%d",
+                                       i->mxlk->name, i->id);
     error = IS_ERR(i->dev);
     if (error) {
         mx_err("failed to register the device %s:%d\n", i->mxlk->name, i->id);
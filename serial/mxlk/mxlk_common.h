@@ -14,9 +14,31 @@
 #include <linux/types.h>
 
 /*
- * Number of MSIs used between the device and host
+ * Max number of TX/RX ring pairs (queues) used between the device and host
  */
-#define MXLK_IRQ_VECTORS    (1)
+#define MXLK_MAX_QUEUES     (4)
+
+/*
+ * Number of MSIs used between the device and host: status plus one RX and one
+ * TX vector per queue at most, status plus a single RX/TX pair at least
+ */
+#define MXLK_IRQ_VECTORS        (3)
+#define MXLK_IRQ_VECTORS_MAX    (1 + 2 * MXLK_MAX_QUEUES)
+
+/*
+ * MSI assignment when the device raises one vector per event type. Vector 0
+ * is also the only vector used when a single MSI is available, in which case
+ * it signals all events.
+ * With nvec vectors enabled, queue q uses RX/TX pair q % ((nvec - 1) / 2), so
+ * queues share the pairs when there are fewer pairs than queues.
+ */
+#define MXLK_IRQ_VECTOR_STATUS  (0)
+#define MXLK_IRQ_VECTOR_RX      (1)
+#define MXLK_IRQ_VECTOR_TX      (2)
+#define MXLK_IRQ_VECTOR_RXQ(q, nvec) \
+    (MXLK_IRQ_VECTOR_RX + 2 * ((q) % (((nvec) - 1) / 2)))
+#define MXLK_IRQ_VECTOR_TXQ(q, nvec) \
+    (MXLK_IRQ_VECTOR_TX + 2 * ((q) % (((nvec) - 1) / 2)))
 
 /*
  * Number of interfaces to statically allocate resources for
@@ -36,6 +58,39 @@
 #define MXLK_DESC_STATUS_SUCCESS    ( 0)
 #define MXLK_DESC_STATUS_ERROR      (-1)
 
+/*
+ * Ownership bits in the transfer descriptor status of the packed ring format
+ * NOTES:
+ *  1) the packed format is used by both sides from minor version
+ *     MXLK_VERSION_MINOR_PACKED on, and replaces the head/tail indices of
+ *     the cap pipes, which are left unused. Both sides start at descriptor 0.
+ *  2) each side keeps a wrap counter per ring position it walks, starting at
+ *     1 and flipped each time the position goes past the end of the ring
+ *  3) the host hands a descriptor over by setting AVAIL to its wrap counter
+ *     and USED to the opposite. The device returns it by setting both bits
+ *     to its own wrap counter, along with length, interface and the status
+ *     code in the low bits.
+ *  4) descriptors are taken and returned in ring order. Each side writes the
+ *     status of a descriptor after the rest of it, and the host may write
+ *     the status of the first descriptor of a batch after the whole batch.
+ *  5) the doorbell still signals descriptors handed over to the device
+ */
+#define MXLK_DESC_STATUS_AVAIL      (1 << 15)
+#define MXLK_DESC_STATUS_USED       (1 << 14)
+#define MXLK_DESC_STATUS_CODE_MASK  (MXLK_DESC_STATUS_USED - 1)
+
+/*
+ * Message flags carried in the top bits of the transfer descriptor interface
+ * field, only once MXLK_TXRX_FEATURE_MSG_FLAGS is enabled
+ * NOTES:
+ *  1) descriptors without flags carry stream data
+ *  2) a message is the chain of descriptors of one interface from SOM to EOM,
+ *     a message held in a single descriptor has both flags set
+ */
+#define MXLK_DESC_FLAG_SOM          (1 << 15)   /* start of message */
+#define MXLK_DESC_FLAG_EOM          (1 << 14)   /* end of message */
+#define MXLK_DESC_FLAGS_MASK        (MXLK_DESC_FLAG_SOM | MXLK_DESC_FLAG_EOM)
+
 /*
  * Layout transfer descriptors used by device and host
  */
@@ -58,8 +113,14 @@ struct mxlk_transfer_desc {
  * Version to be exposed by both device and host
  */
 #define MXLK_VERSION_MAJOR  (1)
-#define MXLK_VERSION_MINOR  (3)
+#define MXLK_VERSION_MINOR  (4)
 #define MXLK_VERSION_BUILD  (0)
+
+/*
+ * First minor version using the packed ring format, the previous one is
+ * still supported with index synchronized rings
+ */
+#define MXLK_VERSION_MINOR_PACKED   (4)
 #define MXLK_MMIO_SIZE      (16 * 1024)
 
 struct mxlk_version {
@@ -101,6 +162,8 @@ struct mxlk_mmio {
 #define MXLK_CAP_BOOT   (1)
 #define MXLK_CAP_STATS  (2)
 #define MXLK_CAP_TXRX   (3)
+#define MXLK_CAP_TXRX_EXT (4)
+#define MXLK_CAP_TXRX_HOST (5)
 
 /*
  * Header at the beginning of each capability to define and link to next
@@ -121,10 +184,26 @@ struct mxlk_cap_boot {
 } __attribute__((packed));
 
 /*
- * Stat collection - to be defined later
+ * Stat collection, free running counters kept by the device
+ * NOTES:
+ *  1) num_counters is the number of counters the device maintains, from
+ *     dma_to_host_bytes on, counters are only ever appended
+ *  2) counters are updated as 64-bit values the host reads as two 32-bit
+ *     halves, it retries a read until the upper half is stable
+ *  3) desc_stalls counts the DMA engine waiting on descriptor accesses,
+ *     ring_full counts data held back for lack of a free RX descriptor,
+ *     doorbells and msis count the doorbells seen and the MSIs raised
  */
 struct mxlk_cap_stats {
     struct mxlk_cap_hdr hdr;
+    uint16_t num_counters;
+    uint16_t reserved;
+    uint64_t dma_to_host_bytes;
+    uint64_t dma_from_host_bytes;
+    uint64_t desc_stalls;
+    uint64_t ring_full;
+    uint64_t doorbells;
+    uint64_t msis;
 } __attribute__((packed));
 
 /*
@@ -147,4 +226,84 @@ struct mxlk_cap_txrx {
     struct mxlk_cap_pipe rx;
 } __attribute__((packed));
 
+/*
+ * Optional features of the extended transmit and receive capability
+ */
+#define MXLK_TXRX_FEATURE_MULTI_MSI   (1 << 0) /* one MSI per event type */
+#define MXLK_TXRX_FEATURE_MULTI_QUEUE (1 << 1) /* several TX/RX ring pairs */
+#define MXLK_TXRX_FEATURE_MSG_FLAGS   (1 << 2) /* MXLK_DESC_FLAG_* supported */
+
+/*
+ * TX/RX ring pair of one queue
+ */
+struct mxlk_cap_queue {
+    struct mxlk_cap_pipe tx;
+    struct mxlk_cap_pipe rx;
+} __attribute__((packed));
+
+/*
+ * Extended transmit and receive capability
+ * NOTES:
+ *  1) features is set by the device, enabled is set by the host to the subset
+ *     of features it accepted before it reports MXLK_STATUS_RUN
+ *  2) devices not exposing this capability are driven with features = 0
+ *  3) queue 0 is always the pipe pair of MXLK_CAP_TXRX. With MULTI_QUEUE,
+ *     queues points to max_queues - 1 struct mxlk_cap_queue describing queues
+ *     1 and up, and the host sets num_queues to the number of queues it uses.
+ *     The device keeps the data of one interface on a single RX queue at a
+ *     time; the host only moves an interface to another TX queue once all
+ *     its descriptors on the current one completed.
+ *  4) with MSG_FLAGS, the descriptors of a message are sent in order on a
+ *     single queue, with no other data of the same interface in between
+ */
+struct mxlk_cap_txrx_ext {
+    struct mxlk_cap_hdr hdr;
+    uint32_t features;
+    uint32_t enabled;
+    uint16_t msi_vectors;
+    uint16_t reserved;
+    uint16_t max_queues;
+    uint16_t num_queues;
+    uint32_t queues;
+} __attribute__((packed));
+
+/*
+ * Bus addresses of the TX/RX rings of one queue, in host memory
+ */
+struct mxlk_cap_host_rings {
+    uint64_t tx;
+    uint64_t rx;
+} __attribute__((packed));
+
+/*
+ * Host memory resident descriptor rings capability
+ * NOTES:
+ *  1) exposed by devices able to access the transfer descriptors by DMA. The
+ *     host may then allocate the rings of every queue it uses in its own
+ *     memory, write their bus addresses to queues[] and set enabled to 1
+ *     before it reports MXLK_STATUS_RUN. The ring offsets of the cap pipes
+ *     are ignored while enabled.
+ *  2) max_queues is set by the device to the number of queues[] it reads,
+ *     the host keeps the rings in BAR2 if it uses more queues than that
+ *  3) rings keep the size and layout given by the cap pipes, and head/tail
+ *     stay in MMIO space. The device completes its descriptor writes before
+ *     it updates the index that returns them, the host writes descriptors
+ *     before the index that publishes them.
+ *  4) the device sets active to 1 when it starts using the host rings. To
+ *     take them back, the host clears enabled, and the device clears active
+ *     once it has stopped fetching descriptors. The host waits up to
+ *     MXLK_HOST_RINGS_RELEASE_MS for that before it frees the rings, and
+ *     leaks them rather than free them under a device that never does.
+ */
+#define MXLK_HOST_RINGS_RELEASE_MS  (100)
+
+struct mxlk_cap_txrx_host {
+    struct mxlk_cap_hdr hdr;
+    uint16_t max_queues;
+    uint16_t enabled;
+    uint16_t active;
+    uint16_t reserved[3];
+    struct mxlk_cap_host_rings queues[MXLK_MAX_QUEUES];
+} __attribute__((packed));
+
 #endif /* SERIAL_MXLK_MXLK_COMMON_H_ */
@@ -10,6 +10,9 @@
 
 #include <linux/uaccess.h>
 #include <linux/delay.h>
+#include <linux/mm.h>
+#include <linux/sched/clock.h>
+#include <linux/sched/signal.h>
 
 #include "mx_pci.h"
 #include "mx_boot.h"
@@ -20,6 +23,9 @@
 #include "mxlk_capabilities.h"
 #include "mxlk_ioctl.h"
 
+#define CREATE_TRACE_POINTS
+#include "mxlk_trace.h"
+
 /* Doorbell parameters. */
 #define MXLK_DOORBELL_ADDR (0xFF0)
 #define MXLK_DOORBELL_DATA (0x72696E67) /* "RING" */
@@ -30,6 +36,14 @@
    when MX device resets itself. */
 #define INVALID(qptr) (qptr == 0xFFFFFFFF)
 
+/* Largest part of a write that is pinned and sent zero-copy in one go */
+#define MXLK_ZC_MAX_LEN (16 * 1024 * 1024)
+
+/* Pools are checked for shrinking at this period, and shrunk after
+   MXLK_POOL_IDLE_RUNS checks in a row with more than half of them unused */
+#define MXLK_POOL_RESIZE_PERIOD (HZ)
+#define MXLK_POOL_IDLE_RUNS     (5)
+
 static atomic_t units_found = ATOMIC_INIT(0);
 
 static int rx_pool_size = 5 * 1024 * 1024;
@@ -40,41 +54,214 @@ static int tx_pool_size = 5 * 1024 * 1024;
 module_param(tx_pool_size, int, S_IRUGO | S_IWUSR | S_IWGRP);
 MODULE_PARM_DESC(tx_pool_size, "transmit pool size (default 5MB)");
 
+static int rx_pool_max = 20 * 1024 * 1024;
+module_param(rx_pool_max, int, S_IRUGO | S_IWUSR | S_IWGRP);
+MODULE_PARM_DESC(rx_pool_max, "receive pool growth limit (default 20MB)");
+
+static int tx_pool_max = 20 * 1024 * 1024;
+module_param(tx_pool_max, int, S_IRUGO | S_IWUSR | S_IWGRP);
+MODULE_PARM_DESC(tx_pool_max, "transmit pool growth limit (default 20MB)");
+
+static int poll_mode = 0;
+module_param(poll_mode, int, S_IRUGO | S_IWUSR | S_IWGRP);
+MODULE_PARM_DESC(poll_mode, "service rings by budgeted polling (default 0)");
+
+static int poll_budget = 64;
+module_param(poll_budget, int, S_IRUGO | S_IWUSR | S_IWGRP);
+MODULE_PARM_DESC(poll_budget, "descriptors per ring per poll run (default 64)");
+
+static int num_queues = 0;
+module_param(num_queues, int, S_IRUGO | S_IWUSR | S_IWGRP);
+MODULE_PARM_DESC(num_queues, "TX/RX ring pairs to use, 0 for one per cpu (default 0)");
+
+static int queue_select = MXLK_QUEUE_SELECT_CPU;
+module_param(queue_select, int, S_IRUGO | S_IWUSR | S_IWGRP);
+MODULE_PARM_DESC(queue_select, "TX queue selection, 0 by cpu, 1 by interface, i.e. queue 0 while there is one (default 0)");
+
+static int zc_threshold = 256 * 1024;
+module_param(zc_threshold, int, S_IRUGO | S_IWUSR | S_IWGRP);
+MODULE_PARM_DESC(zc_threshold, "min write size sent zero-copy, 0 disables (default 256KB)");
+
+static int host_rings = 1;
+module_param(host_rings, int, S_IRUGO | S_IWUSR | S_IWGRP);
+MODULE_PARM_DESC(host_rings, "descriptor rings in host memory if the device supports it (default 1)");
+
+static int service_threads = 0;
+module_param(service_threads, int, S_IRUGO | S_IWUSR | S_IWGRP);
+MODULE_PARM_DESC(service_threads, "service rings from a thread per device instead of the shared workqueue (default 0)");
 
 static ssize_t mxlk_debug_show(struct device *dev,
                                struct device_attribute *attr, char *buf);
 static ssize_t mxlk_debug_store(struct device *dev,
                                 struct device_attribute *attr,
                                 const char *buf, size_t count);
+static ssize_t mxlk_poll_show(struct device *dev,
+                              struct device_attribute *attr, char *buf);
+static ssize_t mxlk_poll_store(struct device *dev,
+                               struct device_attribute *attr,
+                               const char *buf, size_t count);
+static ssize_t mxlk_poll_budget_show(struct device *dev,
+                                     struct device_attribute *attr, char *buf);
+static ssize_t mxlk_poll_budget_store(struct device *dev,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count);
+static ssize_t mxlk_pool_show(struct device *dev,
+                              struct device_attribute *attr, char *buf);
+static ssize_t mxlk_pool_min_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf);
+static ssize_t mxlk_pool_min_store(struct device *dev,
+                                   struct device_attribute *attr,
+                                   const char *buf, size_t count);
+static ssize_t mxlk_pool_max_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf);
+static ssize_t mxlk_pool_max_store(struct device *dev,
+                                   struct device_attribute *attr,
+                                   const char *buf, size_t count);
+static ssize_t mxlk_service_cpus_show(struct device *dev,
+                                      struct device_attribute *attr, char *buf);
+static ssize_t mxlk_service_cpus_store(struct device *dev,
+                                       struct device_attribute *attr,
+                                       const char *buf, size_t count);
+static ssize_t mxlk_service_priority_show(struct device *dev,
+                                          struct device_attribute *attr,
+                                          char *buf);
+static ssize_t mxlk_service_priority_store(struct device *dev,
+                                           struct device_attribute *attr,
+                                           const char *buf, size_t count);
+
+static DEVICE_ATTR(debug, S_IWUSR | S_IRUGO, mxlk_debug_show, mxlk_debug_store);
+static DEVICE_ATTR(poll, S_IWUSR | S_IRUGO, mxlk_poll_show, mxlk_poll_store);
+static DEVICE_ATTR(poll_budget, S_IWUSR | S_IRUGO, mxlk_poll_budget_show,
+                   mxlk_poll_budget_store);
+
+/*
+ * Pool attributes are shared by all devices, so they name the pool by its
+ * direction rather than point to it
+ */
+struct mxlk_pool_attr {
+    struct device_attribute dattr;
+    int direction;
+};
+
+#define MXLK_POOL_ATTR(_name, _mode, _show, _store, _direction)             \
+    static struct mxlk_pool_attr dev_attr_##_name = {                       \
+        .dattr = __ATTR(_name, _mode, _show, _store),                       \
+        .direction = _direction,                                            \
+    }
+
+MXLK_POOL_ATTR(rx_pool, S_IRUGO, mxlk_pool_show, NULL, DMA_FROM_DEVICE);
+MXLK_POOL_ATTR(tx_pool, S_IRUGO, mxlk_pool_show, NULL, DMA_TO_DEVICE);
+MXLK_POOL_ATTR(rx_pool_size, S_IWUSR | S_IRUGO, mxlk_pool_min_show,
+               mxlk_pool_min_store, DMA_FROM_DEVICE);
+MXLK_POOL_ATTR(tx_pool_size, S_IWUSR | S_IRUGO, mxlk_pool_min_show,
+               mxlk_pool_min_store, DMA_TO_DEVICE);
+MXLK_POOL_ATTR(rx_pool_max, S_IWUSR | S_IRUGO, mxlk_pool_max_show,
+               mxlk_pool_max_store, DMA_FROM_DEVICE);
+MXLK_POOL_ATTR(tx_pool_max, S_IWUSR | S_IRUGO, mxlk_pool_max_show,
+               mxlk_pool_max_store, DMA_TO_DEVICE);
+
+static DEVICE_ATTR(service_cpus, S_IWUSR | S_IRUGO, mxlk_service_cpus_show,
+                   mxlk_service_cpus_store);
+static DEVICE_ATTR(service_priority, S_IWUSR | S_IRUGO,
+                   mxlk_service_priority_show, mxlk_service_priority_store);
+
+static struct attribute *mxlk_attrs[] = {
+    &dev_attr_debug.attr,
+    &dev_attr_poll.attr,
+    &dev_attr_poll_budget.attr,
+    &dev_attr_rx_pool.dattr.attr,
+    &dev_attr_tx_pool.dattr.attr,
+    &dev_attr_rx_pool_size.dattr.attr,
+    &dev_attr_tx_pool_size.dattr.attr,
+    &dev_attr_rx_pool_max.dattr.attr,
+    &dev_attr_tx_pool_max.dattr.attr,
+    &dev_attr_service_cpus.attr,
+    &dev_attr_service_priority.attr,
+    NULL
+};
+
+static const struct attribute_group mxlk_attr_group = {
+    .attrs = mxlk_attrs,
+};
 
 static int mxlk_version_check(struct mxlk *mxlk);
 static void mxlk_set_host_status(struct mxlk *mxlk, int status);
 static int mxlk_get_device_status(struct mxlk *mxlk);
 
-static int mxlk_list_init(struct mxlk_list *list);
-static void mxlk_list_cleanup(struct mxlk_list *list);
-static int mxlk_list_put(struct mxlk_list *list, struct mxlk_buf_desc *bd);
-static struct mxlk_buf_desc *mxlk_list_get(struct mxlk_list *list);
-static void mxlk_list_info(struct mxlk_list *list, size_t *bytes, size_t *buffers);
-
-static struct mxlk_buf_desc *mxlk_alloc_bd(size_t length);
-static void mxlk_free_bd(struct mxlk_buf_desc *bd);
+static int mxlk_pool_init(struct mxlk *mxlk, struct mxlk_pool *pool,
+                          int direction, int min, int max);
+static int mxlk_pool_grow(struct mxlk_pool *pool, int count);
+static int mxlk_pool_shrink(struct mxlk_pool *pool, int count);
+static void mxlk_pool_resize_event(struct work_struct *work);
+static void mxlk_pool_cleanup(struct mxlk *mxlk, struct mxlk_pool *pool);
+static void mxlk_pool_put(struct mxlk *mxlk, struct mxlk_pool *pool,
+                          struct mxlk_buf_desc *bd);
+static struct mxlk_buf_desc *mxlk_pool_get(struct mxlk_pool *pool);
+static void mxlk_pool_free(struct mxlk *mxlk, struct mxlk_pool *pool,
+                           struct mxlk_buf_desc *bd);
+static size_t mxlk_pool_count(struct mxlk_pool *pool);
+static int mxlk_pool_get_bulk(struct mxlk_pool *pool,
+                              struct mxlk_buf_desc **bds, int count);
+static void mxlk_pool_free_bulk(struct mxlk *mxlk, struct mxlk_pool *pool,
+                                struct mxlk_buf_desc **bds, int count);
+
+static void mxlk_bd_list_init(struct mxlk_bd_list *list);
+static void mxlk_bd_list_add(struct mxlk_bd_list *list,
+                             struct mxlk_buf_desc *bd);
+static void mxlk_bd_list_splice(struct mxlk_bd_list *list,
+                                struct mxlk_bd_list *other);
+
+static struct mxlk_buf_desc *mxlk_alloc_bd(struct mxlk_pool *pool);
+static void mxlk_free_bd(struct mxlk *mxlk, struct mxlk_buf_desc *bd);
 static struct mxlk_buf_desc *mxlk_alloc_rx_bd(struct mxlk *mxlk);
 static void mxlk_free_rx_bd(struct mxlk *mxlk, struct mxlk_buf_desc * bd);
 static struct mxlk_buf_desc *mxlk_alloc_tx_bd(struct mxlk *mxlk);
 static void mxlk_free_tx_bd(struct mxlk *mxlk, struct mxlk_buf_desc * bd);
+static void mxlk_reset_bd(struct mxlk_buf_desc *bd);
+static int mxlk_alloc_rx_bds(struct mxlk *mxlk, struct mxlk_buf_desc **bds,
+                             int count);
+static int mxlk_alloc_tx_bds(struct mxlk *mxlk, struct mxlk_bd_list *list,
+                             int count);
+static void mxlk_free_bd_list(struct mxlk *mxlk, struct mxlk_pool *pool,
+                              struct mxlk_bd_list *list);
+static void mxlk_zc_bd_done(struct mxlk *mxlk, struct mxlk_buf_desc *bd,
+                            int error);
+static void mxlk_zc_put(struct mxlk *mxlk, struct mxlk_zc *zc);
+static ssize_t mxlk_zc_write(struct mxlk_interface *inf,
+                             struct iov_iter *from, u64 stamp);
+static ssize_t mxlk_read_msg(struct mxlk_interface *inf, struct iov_iter *to);
+static ssize_t mxlk_write_msg(struct mxlk_interface *inf,
+                              struct iov_iter *from, bool nowait, u64 stamp);
 
 static int mxlk_all_chrdev_init(struct mxlk *mxlk);
 static void mxlk_all_chrdev_cleanup(struct mxlk *mxlk);
-static void mxlk_interfaces_init(struct mxlk *mxlk);
+static int mxlk_interfaces_init(struct mxlk *mxlk);
 static void mxlk_interfaces_cleanup(struct mxlk *mxlk);
-static void mxlk_interface_init(struct mxlk *mxlk, int id);
+static int mxlk_interface_init(struct mxlk *mxlk, int id);
 static void mxlk_interface_cleanup(struct mxlk_interface *inf);
 static void mxlk_add_bd_to_interface(struct mxlk *mxlk, struct mxlk_buf_desc *bd);
+static void mxlk_add_record_to_interface(struct mxlk *mxlk,
+                                         struct mxlk_interface *inf,
+                                         struct mxlk_bd_list *record);
+static void mxlk_flush_pending(struct mxlk_interface *inf);
+static void mxlk_flush_event_handler(struct work_struct *work);
+static void mxlk_busy_poll(struct mxlk_interface *inf, unsigned int usecs);
+static struct mxlk_queue *mxlk_select_txq(struct mxlk_interface *inf);
+static void mxlk_queue_write(struct mxlk_interface *inf,
+                             struct mxlk_buf_desc *head, int nbds, u64 stamp);
 
 static int mxlk_discover_txrx(struct mxlk *mxlk);
+static void mxlk_discover_txrx_ext(struct mxlk *mxlk);
+static void mxlk_discover_txrx_host(struct mxlk *mxlk);
+static void mxlk_discover_stats(struct mxlk *mxlk);
 static int mxlk_txrx_init(struct mxlk *mxlk, struct mxlk_cap_txrx *cap);
 static void mxlk_txrx_cleanup(struct mxlk *mxlk);
+static int mxlk_queue_init(struct mxlk_queue *queue,
+                           struct mxlk_cap_pipe *tx_cap,
+                           struct mxlk_cap_pipe *rx_cap,
+                           struct mxlk_cap_host_rings *host_cap,
+                           size_t write_size);
+static void mxlk_queue_cleanup(struct mxlk_queue *queue);
 
 static void mxlk_set_td_address(struct mxlk_transfer_desc *td, u64 address);
 static u64  mxlk_get_td_address(struct mxlk_transfer_desc *td);
@@ -84,6 +271,19 @@ static void mxlk_set_td_interface(struct mxlk_transfer_desc *td, u16 interface);
 static u16  mxlk_get_td_interface(struct mxlk_transfer_desc *td);
 static void mxlk_set_td_status(struct mxlk_transfer_desc *td, u16 status);
 static u16  mxlk_get_td_status(struct mxlk_transfer_desc *td);
+static u16  mxlk_get_ring_status(struct mxlk_pipe *p, u32 index);
+static u64  mxlk_get_td_completion(struct mxlk_pipe *p, u32 index);
+static u16  mxlk_td_avail_status(struct mxlk_pipe *p, u16 code);
+static bool mxlk_td_is_used(struct mxlk_pipe *p, u16 status);
+static void mxlk_stage_td(struct mxlk_transfer_desc *td, u64 address,
+                          u32 length, u16 interface, u16 status);
+static void mxlk_write_tds(struct mxlk_pipe *p,
+                           struct mxlk_transfer_desc *stage, u32 from, u32 to);
+static void mxlk_pipe_map_wc(struct mxlk *mxlk, struct mxlk_pipe *p,
+                             u32 offset);
+static void mxlk_pipe_unmap_wc(struct mxlk_pipe *p);
+static int  mxlk_pipe_alloc_host(struct mxlk *mxlk, struct mxlk_pipe *p);
+static void mxlk_pipe_free_host(struct mxlk *mxlk, struct mxlk_pipe *p);
 
 static void mxlk_set_tdr_head(struct mxlk_pipe *p, u32 head);
 static u32  mxlk_get_tdr_head(struct mxlk_pipe *p);
@@ -91,54 +291,143 @@ static void mxlk_set_tdr_tail(struct mxlk_pipe *p, u32 tail);
 static u32  mxlk_get_tdr_tail(struct mxlk_pipe *p);
 
 static irqreturn_t mxlk_interrupt(int irq, void *args);
+static irqreturn_t mxlk_rx_interrupt(int irq, void *args);
+static irqreturn_t mxlk_tx_interrupt(int irq, void *args);
 static int mxlk_events_init(struct mxlk *mxlk);
 static void mxlk_events_cleanup(struct mxlk *mxlk);
+static int mxlk_rx_process(struct mxlk_queue *queue, int budget,
+                           bool *restart, bool nowait);
+static int mxlk_tx_process(struct mxlk_queue *queue, int budget);
+static struct mxlk_buf_desc *mxlk_tx_dequeue(struct mxlk_queue *queue);
+static void mxlk_rx_event(struct mxlk_queue *queue);
 static void mxlk_rx_event_handler(struct work_struct *work);
+static void mxlk_rx_kwork_handler(struct kthread_work *work);
+static void mxlk_tx_event(struct mxlk_queue *queue);
 static void mxlk_tx_event_handler(struct work_struct *work);
+static void mxlk_tx_kwork_handler(struct kthread_work *work);
+static void mxlk_poll(struct mxlk *mxlk);
+static void mxlk_poll_handler(struct work_struct *work);
+static void mxlk_poll_kwork_handler(struct kthread_work *work);
+static void mxlk_poll_queue(struct mxlk *mxlk);
+static void mxlk_poll_schedule(struct mxlk *mxlk);
+static void mxlk_poll_stop(struct mxlk *mxlk);
+static void mxlk_poll_irq_disable(struct mxlk *mxlk);
+static void mxlk_poll_irq_enable(struct mxlk *mxlk);
 static void mxlk_status_event_handler(struct work_struct *work);
 static void mxlk_send_doorbell_handler(struct work_struct *work);
-static void mxlk_start_tx(struct mxlk *mxlk);
-static void mxlk_start_rx(struct mxlk *mxlk);
+static void mxlk_start_tx(struct mxlk_queue *queue);
+static void mxlk_start_rx(struct mxlk_queue *queue);
+static int mxlk_service_init(struct mxlk *mxlk);
+static void mxlk_service_cleanup(struct mxlk *mxlk);
+static int mxlk_service_set_priority(struct mxlk *mxlk, int priority);
+static void mxlk_start_all(struct mxlk *mxlk);
 static void mxlk_send_doorbell(struct mxlk *mxlk);
 static void mxlk_ring_doorbell(struct mxlk *mxlk);
 static int mxlk_comms_init(struct mxlk *mxlk);
 static void mxlk_comms_cleanup(struct mxlk *mxlk);
 
-static int mxlk_map_dma(struct mxlk *mxlk, struct mxlk_dma_desc *dd,
-                        int direction);
-static void mxlk_unmap_dma(struct mxlk *mxlk, struct mxlk_dma_desc *dd,
-                           int direction);
+static void mxlk_sync_dma_for_device(struct mxlk *mxlk,
+                                     struct mxlk_dma_desc *dd, int direction);
+static void mxlk_sync_dma_for_cpu(struct mxlk *mxlk, struct mxlk_dma_desc *dd,
+                                  size_t length, int direction);
 
 static ssize_t mxlk_debug_show(struct device *dev,
                                struct device_attribute *attr, char *buf)
 {
     struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
     struct mxlk *mxlk = pci_get_drvdata(pdev);
-    struct mxlk_stats new = mxlk->stats;
-
-    snprintf(buf, 4096,
-        "tx_krn, pkts %zu (%zu) bytes %zu (%zu)\n"
-        "tx_usr, pkts %zu (%zu) bytes %zu (%zu)\n"
-        "rx_krn, pkts %zu (%zu) bytes %zu (%zu)\n"
-        "rx_usr, pkts %zu (%zu) bytes %zu (%zu)\n"
-        "interrupts %zu (%zu) doorbells %zu (%zu)\n"
-        "rx runs %zu (%zu) tx runs %zu (%zu)\n",
-        new.tx_krn.pkts,   (new.tx_krn.pkts   - mxlk->stats_old.tx_krn.pkts),
-        new.tx_krn.bytes,  (new.tx_krn.bytes  - mxlk->stats_old.tx_krn.bytes),
-        new.tx_usr.pkts,   (new.tx_usr.pkts   - mxlk->stats_old.tx_usr.pkts),
-        new.tx_usr.bytes,  (new.tx_usr.bytes  - mxlk->stats_old.tx_usr.bytes),
-        new.rx_krn.pkts,   (new.rx_krn.pkts   - mxlk->stats_old.rx_krn.pkts),
-        new.rx_krn.bytes,  (new.rx_krn.bytes  - mxlk->stats_old.rx_krn.bytes),
-        new.rx_usr.pkts,   (new.rx_usr.pkts   - mxlk->stats_old.rx_usr.pkts),
-        new.rx_usr.bytes,  (new.rx_usr.bytes  - mxlk->stats_old.rx_usr.bytes),
-        new.interrupts,    (new.interrupts    - mxlk->stats_old.interrupts),
-        new.doorbells,     (new.doorbells     - mxlk->stats_old.doorbells),
-        new.rx_event_runs, (new.rx_event_runs - mxlk->stats_old.rx_event_runs),
-        new.tx_event_runs, (new.tx_event_runs - mxlk->stats_old.tx_event_runs));
-
-    mxlk->stats_old = new;
-
-    return strlen(buf);
+    u64 s[MXLK_STAT_NUM], q[MXLK_QSTAT_NUM], k[MXLK_QSTAT_NUM];
+    u64 d[MXLK_DSTAT_NUM];
+    u64 interrupts;
+    size_t len;
+    int index, stat;
+    bool dev_stats;
+
+    memset(k, 0, sizeof(k));
+
+    /* Everything is reported relative to the last write to this file */
+    mutex_lock(&mxlk->stats_lock);
+    mxlk_stats_read(mxlk, s, &interrupts);
+    for (stat = 0; stat < MXLK_STAT_NUM; stat++) {
+        s[stat] -= mxlk->stats_base[stat];
+    }
+    interrupts -= mxlk->interrupts_base;
+
+    len = 0;
+    for (index = 0; index < mxlk->num_queues; index++) {
+        mxlk_queue_stats_read(mxlk->queues + index, q);
+        for (stat = 0; stat < MXLK_QSTAT_NUM; stat++) {
+            q[stat] -= mxlk->queue_stats_base[index][stat];
+            k[stat] += q[stat];
+        }
+        len += scnprintf(buf + len, PAGE_SIZE - len,
+            "queue %d, tx pkts %llu bytes %llu rx pkts %llu bytes %llu "
+            "runs tx %llu rx %llu reaps %llu (%llu) rx %llu (%llu)\n", index,
+            q[MXLK_QSTAT_tx_pkts], q[MXLK_QSTAT_tx_bytes],
+            q[MXLK_QSTAT_rx_pkts], q[MXLK_QSTAT_rx_bytes],
+            q[MXLK_QSTAT_tx_event_runs], q[MXLK_QSTAT_rx_event_runs],
+            q[MXLK_QSTAT_tx_reap_runs], q[MXLK_QSTAT_tx_reaped],
+            q[MXLK_QSTAT_rx_runs], q[MXLK_QSTAT_rx_received]);
+    }
+    dev_stats = mxlk_dev_stats_read(mxlk, d);
+    for (stat = 0; stat < MXLK_DSTAT_NUM; stat++) {
+        d[stat] -= mxlk->dev_stats_base[stat];
+    }
+    mutex_unlock(&mxlk->stats_lock);
+
+    len += scnprintf(buf + len, PAGE_SIZE - len,
+        "tx_krn, pkts %llu bytes %llu\n"
+        "tx_usr, pkts %llu bytes %llu\n"
+        "rx_krn, pkts %llu bytes %llu\n"
+        "rx_usr, pkts %llu bytes %llu\n"
+        "interrupts %llu doorbells %llu\n"
+        "rx runs %llu tx runs %llu\n"
+        "polls %llu budget exhausted %llu\n"
+        "busy polls %llu hits %llu\n"
+        "zc writes %llu fallbacks %llu\n"
+        "rx drops, status %llu interface %llu message %llu "
+        "refill failures %llu\n"
+        "queue drops, read %llu write %llu pool %llu\n",
+        k[MXLK_QSTAT_tx_pkts], k[MXLK_QSTAT_tx_bytes],
+        s[MXLK_STAT_tx_usr_pkts], s[MXLK_STAT_tx_usr_bytes],
+        k[MXLK_QSTAT_rx_pkts], k[MXLK_QSTAT_rx_bytes],
+        s[MXLK_STAT_rx_usr_pkts], s[MXLK_STAT_rx_usr_bytes],
+        interrupts, s[MXLK_STAT_doorbells],
+        k[MXLK_QSTAT_rx_event_runs], k[MXLK_QSTAT_tx_event_runs],
+        s[MXLK_STAT_polls], s[MXLK_STAT_poll_budget_exhausted],
+        s[MXLK_STAT_busy_polls], s[MXLK_STAT_busy_poll_hits],
+        s[MXLK_STAT_zc_writes], s[MXLK_STAT_zc_fallbacks],
+        s[MXLK_STAT_rx_drops_status], s[MXLK_STAT_rx_drops_interface],
+        s[MXLK_STAT_rx_drops_msg], s[MXLK_STAT_rx_refill_failures],
+        s[MXLK_STAT_read_queue_drops], s[MXLK_STAT_write_queue_drops],
+        s[MXLK_STAT_pool_drops]);
+
+    /* Device side of the link, next to the host doorbells and interrupts */
+    if (dev_stats) {
+        len += scnprintf(buf + len, PAGE_SIZE - len,
+            "dev, dma to host %llu from host %llu desc stalls %llu "
+            "ring full %llu\n"
+            "dev, doorbells %llu msis %llu\n",
+            d[MXLK_DSTAT_dma_to_host_bytes], d[MXLK_DSTAT_dma_from_host_bytes],
+            d[MXLK_DSTAT_desc_stalls], d[MXLK_DSTAT_ring_full],
+            d[MXLK_DSTAT_doorbells], d[MXLK_DSTAT_msis]);
+    }
+
+    return len;
+}
+
+static void mxlk_debug_reset(struct mxlk *mxlk)
+{
+    int index;
+
+    mutex_lock(&mxlk->stats_lock);
+    mxlk_stats_read(mxlk, mxlk->stats_base, &mxlk->interrupts_base);
+    for (index = 0; index < MXLK_MAX_QUEUES; index++) {
+        mxlk_queue_stats_read(mxlk->queues + index,
+                              mxlk->queue_stats_base[index]);
+    }
+    mxlk_dev_stats_read(mxlk, mxlk->dev_stats_base);
+    mutex_unlock(&mxlk->stats_lock);
 }
 
 static ssize_t mxlk_debug_store(struct device *dev,
@@ -148,1013 +437,3789 @@ static ssize_t mxlk_debug_store(struct device *dev,
     struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
     struct mxlk *mxlk = pci_get_drvdata(pdev);
 
-    memset(&mxlk->stats_old, 0, sizeof(struct mxlk_stats));
-    memset(&mxlk->stats,     0, sizeof(struct mxlk_stats));
+    mxlk_debug_reset(mxlk);
 
     return count;
 }
 
-static int mxlk_version_check(struct mxlk *mxlk)
+static ssize_t mxlk_poll_show(struct device *dev,
+                              struct device_attribute *attr, char *buf)
 {
-    struct mxlk_version version;
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
 
-    mx_rd_buf(mxlk->mmio, MXLK_MMIO_VERSION, &version, sizeof(version));
+    return scnprintf(buf, PAGE_SIZE, "%d\n", mxlk->poll_mode);
+}
 
-    if ((version.major != MXLK_VERSION_MAJOR) ||
-        (version.minor != MXLK_VERSION_MINOR)) {
-        mx_err("version mismatch, dev : %d.%d.%d, host : %d.%d.%d\n",
-               version.major, version.minor, version.build,
-               MXLK_VERSION_MAJOR, MXLK_VERSION_MINOR, MXLK_VERSION_BUILD);
+static ssize_t mxlk_poll_store(struct device *dev,
+                               struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
+    bool enable;
+    int error;
 
-        return -EIO;
+    error = kstrtobool(buf, &enable);
+    if (error) {
+        return error;
     }
 
-    mx_info("versions, dev : %d.%d.%d, host : %d.%d.%d\n",
-            version.major, version.minor, version.build,
-            MXLK_VERSION_MAJOR, MXLK_VERSION_MINOR, MXLK_VERSION_BUILD);
+    /* A poll already scheduled runs to completion and re-arms interrupts */
+    mxlk->poll_mode = enable;
 
-    return 0;
+    return count;
 }
 
-static void mxlk_set_host_status(struct mxlk *mxlk, int status)
+static ssize_t mxlk_poll_budget_show(struct device *dev,
+                                     struct device_attribute *attr, char *buf)
 {
-    mxlk->status = status;
-    mx_wr32(mxlk->mmio, MXLK_MMIO_HOST_STATUS, status);
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
+
+    return scnprintf(buf, PAGE_SIZE, "%d\n", mxlk->poll_budget);
 }
 
-static int mxlk_get_device_status(struct mxlk *mxlk)
+static ssize_t mxlk_poll_budget_store(struct device *dev,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count)
 {
-    return mx_rd32(mxlk->mmio, MXLK_MMIO_DEV_STATUS);
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
+    int budget;
+    int error;
+
+    error = kstrtoint(buf, 0, &budget);
+    if (error) {
+        return error;
+    }
+    if (budget <= 0) {
+        return -EINVAL;
+    }
+
+    mxlk->poll_budget = budget;
+
+    return count;
 }
 
-static int mxlk_list_init(struct mxlk_list *list)
+static struct mxlk_pool *mxlk_attr_to_pool(struct mxlk *mxlk,
+                                           struct device_attribute *attr)
 {
-    spin_lock_init(&list->lock);
-    list->bytes = 0;
-    list->buffers = 0;
-    list->head = NULL;
-    list->tail = NULL;
+    struct mxlk_pool_attr *pa = container_of(attr, struct mxlk_pool_attr,
+                                             dattr);
 
-    return 0;
+    return (pa->direction == DMA_FROM_DEVICE) ? &mxlk->rx_pool :
+                                                &mxlk->tx_pool;
 }
 
-static void mxlk_list_cleanup(struct mxlk_list *list)
+static ssize_t mxlk_pool_show(struct device *dev,
+                              struct device_attribute *attr, char *buf)
 {
-    struct mxlk_buf_desc *bd;
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
+    struct mxlk_pool *pool = mxlk_attr_to_pool(mxlk, attr);
+    int total = atomic_read(&pool->total);
+    size_t free = mxlk_pool_count(pool);
+
+    return scnprintf(buf, PAGE_SIZE,
+                     "bufs %d free %zu in use %zu min %d max %d (%zu bytes each)\n",
+                     total, free, (total > free) ? total - free : 0,
+                     READ_ONCE(pool->min), READ_ONCE(pool->max),
+                     mxlk->fragment_size);
+}
 
-    spin_lock(&list->lock);
-    while (list->head) {
-        bd = list->head;
-        list->head = bd->next;
-        mxlk_free_bd(bd);
-    }
+static ssize_t mxlk_pool_min_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf)
+{
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
+    struct mxlk_pool *pool = mxlk_attr_to_pool(mxlk, attr);
 
-    list->head = list->tail = NULL;
-    spin_unlock(&list->lock);
+    return scnprintf(buf, PAGE_SIZE, "%zu\n",
+                     READ_ONCE(pool->min) * mxlk->fragment_size);
 }
 
-static int mxlk_list_put(struct mxlk_list *list, struct mxlk_buf_desc *bd)
+static ssize_t mxlk_pool_min_store(struct device *dev,
+                                   struct device_attribute *attr,
+                                   const char *buf, size_t count)
 {
-    if (!bd) {
-        mx_err("attempt to add null buf desc to list!\n");
-        return -EINVAL;
-    }
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
+    struct mxlk_pool *pool = mxlk_attr_to_pool(mxlk, attr);
+    unsigned long bytes, bds;
+    int error;
 
-    spin_lock(&list->lock);
-    if (list->head) {
-        list->tail->next = bd;
-    } else {
-        list->head = bd;
+    error = kstrtoul(buf, 0, &bytes);
+    if (error) {
+        return error;
     }
-    while (bd) {
-        list->tail = bd;
-        list->bytes += bd->length;
-        list->buffers++;
-        bd = bd->next;
+
+    bds = DIV_ROUND_UP(bytes, mxlk->fragment_size);
+    if ((bds < pool->floor) || (bds > READ_ONCE(pool->max))) {
+        return -EINVAL;
     }
-    spin_unlock(&list->lock);
 
-    return 0;
+    WRITE_ONCE(pool->min, bds);
+    mod_delayed_work(mxlk->wq, &pool->resize, 0);
+
+    return count;
 }
 
-static struct mxlk_buf_desc *mxlk_list_get(struct mxlk_list *list)
+static ssize_t mxlk_pool_max_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf)
 {
-    struct mxlk_buf_desc *bd;
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
+    struct mxlk_pool *pool = mxlk_attr_to_pool(mxlk, attr);
 
-    spin_lock(&list->lock);
-    bd = list->head;
-    if (list->head) {
-        list->head = list->head->next;
-        if (!list->head) {
-            list->tail = NULL;
-        }
-        bd->next = NULL;
-        list->bytes -= bd->length;
-        list->buffers--;
+    return scnprintf(buf, PAGE_SIZE, "%zu\n",
+                     READ_ONCE(pool->max) * mxlk->fragment_size);
+}
+
+static ssize_t mxlk_pool_max_store(struct device *dev,
+                                   struct device_attribute *attr,
+                                   const char *buf, size_t count)
+{
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
+    struct mxlk_pool *pool = mxlk_attr_to_pool(mxlk, attr);
+    unsigned long bytes, bds;
+    int error;
+
+    error = kstrtoul(buf, 0, &bytes);
+    if (error) {
+        return error;
     }
-    spin_unlock(&list->lock);
 
-    return bd;
+    /* Bounded by the ring capacity fixed when the pool was created */
+    bds = bytes / mxlk->fragment_size;
+    if ((bds < READ_ONCE(pool->min)) || (bds > pool->ring.mask + 1)) {
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(pool->max, bds);
+    mod_delayed_work(mxlk->wq, &pool->resize, 0);
+
+    return count;
 }
 
-static void mxlk_list_info(struct mxlk_list *list, size_t *bytes, size_t *buffers)
+static ssize_t mxlk_service_cpus_show(struct device *dev,
+                                      struct device_attribute *attr, char *buf)
 {
-    spin_lock(&list->lock);
-    *bytes = list->bytes;
-    *buffers = list->buffers;
-    spin_unlock(&list->lock);
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
+    const struct cpumask *cpus = &mxlk->service_cpus;
+
+    if (!mxlk->service) {
+        return -EOPNOTSUPP;
+    }
+
+    /* Thread default until CPUs are set */
+    if (cpumask_empty(cpus)) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,3,0)
+        cpus = mxlk->service->task->cpus_ptr;
+#else
+        cpus = &mxlk->service->task->cpus_allowed;
+#endif
+    }
+
+    return scnprintf(buf, PAGE_SIZE, "%*pbl\n", cpumask_pr_args(cpus));
 }
 
-static struct mxlk_buf_desc *mxlk_alloc_bd(size_t length)
+static ssize_t mxlk_service_cpus_store(struct device *dev,
+                                       struct device_attribute *attr,
+                                       const char *buf, size_t count)
 {
-    struct mxlk_buf_desc *bd;
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
+    cpumask_var_t cpus;
+    int error;
 
-    bd = kzalloc(sizeof(*bd), GFP_KERNEL);
-    if (!bd) {
-        return NULL;
+    if (!mxlk->service) {
+        return -EOPNOTSUPP;
     }
 
-    bd->head = kzalloc(roundup(length, cache_line_size()), GFP_KERNEL);
-    if (!bd->head) {
-        kfree(bd);
-        return NULL;
+    if (!alloc_cpumask_var(&cpus, GFP_KERNEL)) {
+        return -ENOMEM;
     }
 
-    bd->data = bd->head;
-    bd->length = bd->true_len = length;
-    bd->next = NULL;
+    /* Fails unless at least one of the CPUs is online */
+    error = cpulist_parse(buf, cpus);
+    if (!error) {
+        error = set_cpus_allowed_ptr(mxlk->service->task, cpus);
+    }
+    if (!error) {
+        /* kept for the thread created again after a reset */
+        cpumask_copy(&mxlk->service_cpus, cpus);
+    }
+    free_cpumask_var(cpus);
 
-    return bd;
+    return error ? error : count;
 }
 
-static void mxlk_free_bd(struct mxlk_buf_desc *bd)
+static ssize_t mxlk_service_priority_show(struct device *dev,
+                                          struct device_attribute *attr,
+                                          char *buf)
 {
-    if (bd) {
-        kfree(bd->head);
-        kfree(bd);
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
+
+    if (!mxlk->service) {
+        return -EOPNOTSUPP;
     }
+
+    return scnprintf(buf, PAGE_SIZE, "%d\n", READ_ONCE(mxlk->service_priority));
 }
 
-static struct mxlk_buf_desc *mxlk_alloc_rx_bd(struct mxlk *mxlk)
+static ssize_t mxlk_service_priority_store(struct device *dev,
+                                           struct device_attribute *attr,
+                                           const char *buf, size_t count)
 {
-    struct mxlk_buf_desc *bd;
+    struct pci_dev *pdev = container_of(dev, struct pci_dev, dev);
+    struct mxlk *mxlk = pci_get_drvdata(pdev);
+    int priority;
+    int error;
 
-    bd = mxlk_list_get(&mxlk->rx_pool);
-    if (bd) {
-        bd->data = bd->head;
-        bd->length = bd->true_len;
-        bd->next = NULL;
-        bd->interface = -1;
+    if (!mxlk->service) {
+        return -EOPNOTSUPP;
     }
 
-    return bd;
-}
+    error = kstrtoint(buf, 0, &priority);
+    if (error) {
+        return error;
+    }
 
-static void mxlk_free_rx_bd(struct mxlk *mxlk, struct mxlk_buf_desc * bd)
-{
-    if (bd) {
-        mxlk_list_put(&mxlk->rx_pool, bd);
+    if ((priority < 0) || (priority >= MAX_RT_PRIO)) {
+        return -EINVAL;
     }
+
+    error = mxlk_service_set_priority(mxlk, priority);
+
+    return error ? error : count;
 }
 
-static struct mxlk_buf_desc *mxlk_alloc_tx_bd(struct mxlk *mxlk)
+static int mxlk_version_check(struct mxlk *mxlk)
 {
-    struct mxlk_buf_desc *bd;
+    struct mxlk_version version;
 
-    bd = mxlk_list_get(&mxlk->tx_pool);
-    if (bd) {
-        bd->data = bd->head;
-        bd->length = bd->true_len;
-        bd->next = NULL;
-        bd->interface = -1;
+    mx_rd_buf(mxlk->mmio, MXLK_MMIO_VERSION, &version, sizeof(version));
+
+    /* Devices of the previous minor version keep index synchronized rings */
+    if ((version.major != MXLK_VERSION_MAJOR) ||
+        (version.minor < MXLK_VERSION_MINOR_PACKED - 1) ||
+        (version.minor > MXLK_VERSION_MINOR)) {
+        mx_err("version mismatch, dev : %d.%d.%d, host : %d.%d.%d\n",
+               version.major, version.minor, version.build,
+               MXLK_VERSION_MAJOR, MXLK_VERSION_MINOR, MXLK_VERSION_BUILD);
+
+        return -EIO;
     }
 
-    return bd;
+    mx_info("versions, dev : %d.%d.%d, host : %d.%d.%d\n",
+            version.major, version.minor, version.build,
+            MXLK_VERSION_MAJOR, MXLK_VERSION_MINOR, MXLK_VERSION_BUILD);
+
+    mxlk->packed = (version.minor >= MXLK_VERSION_MINOR_PACKED);
+
+    return 0;
 }
 
-static void mxlk_free_tx_bd(struct mxlk *mxlk, struct mxlk_buf_desc * bd)
+static void mxlk_set_host_status(struct mxlk *mxlk, int status)
 {
-    if (bd) {
-        mxlk_list_put(&mxlk->tx_pool, bd);
-    }
+    mxlk->status = status;
+    mx_wr32(mxlk->mmio, MXLK_MMIO_HOST_STATUS, status);
 }
 
-static int mxlk_all_chrdev_init(struct mxlk *mxlk)
+static int mxlk_get_device_status(struct mxlk *mxlk)
+{
+    return mx_rd32(mxlk->mmio, MXLK_MMIO_DEV_STATUS);
+}
+
+static int mxlk_pool_init(struct mxlk *mxlk, struct mxlk_pool *pool,
+                          int direction, int min, int max)
 {
     int error;
-    int index;
-    struct mxlk_interface *inf;
 
-    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
-        inf = mxlk->interfaces + index;
-        /* Set mxlk pointer now because it used by mxlk_chrdev_add(). The rest
-         * of the interface structure will be initialized later. */
-        inf->mxlk = mxlk;
-        error = mxlk_chrdev_add(inf);
-        if (error) {
-            return error;
+    pool->mxlk = mxlk;
+    pool->direction = direction;
+    pool->floor = pool->min = min;
+    pool->max = max;
+    pool->idle_runs = 0;
+    pool->caches = NULL;
+    pool->frag_page = NULL;
+    pool->frag_offset = 0;
+    atomic_set(&pool->total, 0);
+    atomic_set(&pool->grow, 0);
+    INIT_DELAYED_WORK(&pool->resize, mxlk_pool_resize_event);
+
+    /* Sized once for the max, the ring then never has to move */
+    error = mxlk_ring_init(&pool->ring, max);
+    if (error) {
+        return error;
+    }
+
+    /* CPU caches hold at most half the pool between them, so no CPU starves
+     * for long on bds stranded in the caches of other CPUs */
+    pool->cache_size = min_t(size_t, min / (2 * num_possible_cpus()),
+                             MXLK_BD_CACHE_SIZE);
+    pool->batch = pool->cache_size / 2;
+    if (pool->batch >= 2) {
+        pool->caches = alloc_percpu(struct mxlk_bd_cache);
+        if (!pool->caches) {
+            return -ENOMEM;
         }
     }
 
+    if (mxlk_pool_grow(pool, min) != min) {
+        return -ENOMEM;
+    }
+
+    queue_delayed_work(mxlk->wq, &pool->resize, MXLK_POOL_RESIZE_PERIOD);
+
     return 0;
 }
 
-static void mxlk_all_chrdev_cleanup(struct mxlk *mxlk)
+static void mxlk_pool_cleanup(struct mxlk *mxlk, struct mxlk_pool *pool)
 {
-    int index;
-    struct mxlk_interface *inf;
+    int cpu;
+    struct mxlk_bd_cache *cache;
+    struct mxlk_buf_desc *bd;
 
-    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
-        inf = mxlk->interfaces + index;
-        mxlk_chrdev_remove(inf);
+    if (!pool->ring.slots) {
+        return;
+    }
+
+    cancel_delayed_work_sync(&pool->resize);
+
+    if (pool->caches) {
+        for_each_possible_cpu(cpu) {
+            cache = per_cpu_ptr(pool->caches, cpu);
+            while (cache->count) {
+                mxlk_free_bd(mxlk, cache->bds[--cache->count]);
+            }
+        }
+        free_percpu(pool->caches);
+        pool->caches = NULL;
+    }
+
+    while ((bd = mxlk_ring_pop(&pool->ring))) {
+        mxlk_free_bd(mxlk, bd);
+    }
+    mxlk_ring_cleanup(&pool->ring);
+    atomic_set(&pool->total, 0);
+
+    if (pool->frag_page) {
+        put_page(pool->frag_page);
+        pool->frag_page = NULL;
     }
 }
 
-static void mxlk_interfaces_init(struct mxlk *mxlk)
+static int mxlk_pool_grow(struct mxlk_pool *pool, int count)
 {
     int index;
+    struct mxlk *mxlk = pool->mxlk;
+    struct mxlk_buf_desc *bd;
 
-    mxlk_list_init(&mxlk->write);
-    init_waitqueue_head(&mxlk->wr_waitq);
-    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
-        mxlk_interface_init(mxlk, index);
+    for (index = 0; index < count; index++) {
+        bd = mxlk_alloc_bd(pool);
+        if (!bd) {
+            break;
+        }
+        atomic_inc(&pool->total);
+        mxlk_pool_put(mxlk, pool, bd);
     }
+
+    return index;
 }
 
-static void mxlk_interfaces_cleanup(struct mxlk *mxlk)
+/* Only bds in the shared ring are released, cached and in use ones stay */
+static int mxlk_pool_shrink(struct mxlk_pool *pool, int count)
 {
     int index;
+    struct mxlk_buf_desc *bd;
 
-    mxlk_list_cleanup(&mxlk->write);
-    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
-        mxlk_interface_cleanup(mxlk->interfaces + index);
+    for (index = 0; index < count; index++) {
+        bd = mxlk_ring_pop(&pool->ring);
+        if (!bd) {
+            break;
+        }
+        atomic_dec(&pool->total);
+        mxlk_free_bd(pool->mxlk, bd);
     }
+
+    return index;
 }
 
-static void mxlk_interface_init(struct mxlk *mxlk, int id)
+static void mxlk_pool_resize_event(struct work_struct *work)
 {
-    struct mxlk_interface *inf = mxlk->interfaces + id;
+    struct mxlk_pool *pool = container_of(to_delayed_work(work),
+                                          struct mxlk_pool, resize);
+    struct mxlk *mxlk = pool->mxlk;
+    int total = atomic_read(&pool->total);
+    int min = READ_ONCE(pool->min);
+    int max = READ_ONCE(pool->max);
+    int step = max(total / 4, 1);
+    int free = mxlk_pool_count(pool);
+    int done = 0;
+
+    if (total < min) {
+        done = mxlk_pool_grow(pool, min - total);
+    } else if (total > max) {
+        mxlk_pool_shrink(pool, total - max);
+    } else if (atomic_xchg(&pool->grow, 0)) {
+        done = mxlk_pool_grow(pool, min(step, max - total));
+        pool->idle_runs = 0;
+    } else if ((free > total / 2) && (total > min)) {
+        if (++pool->idle_runs >= MXLK_POOL_IDLE_RUNS) {
+            mxlk_pool_shrink(pool, min(step, total - min));
+            pool->idle_runs = 0;
+        }
+    } else {
+        pool->idle_runs = 0;
+    }
 
-    inf->id = id;
-    inf->opened = 0;
+    if (done) {
+        mx_dbg("%s pool grown by %d to %d bufs\n",
+               (pool->direction == DMA_TO_DEVICE) ? "tx" : "rx",
+               done, atomic_read(&pool->total));
+        if (pool->direction == DMA_TO_DEVICE) {
+            wake_up(&mxlk->wr_waitq);
+        }
+    }
 
-    inf->partial_read = NULL;
-    mxlk_list_init(&inf->read);
-    mutex_init(&inf->rlock);
-    mutex_init(&inf->wlock);
-    init_waitqueue_head(&inf->rd_waitq);
+    queue_delayed_work(mxlk->wq, &pool->resize, MXLK_POOL_RESIZE_PERIOD);
 }
 
-static void mxlk_interface_cleanup(struct mxlk_interface *inf)
+/* Asks the resize work to grow the pool, once per resize run */
+static void mxlk_pool_request_grow(struct mxlk_pool *pool)
 {
-    struct mxlk_buf_desc *bd;
-
-    inf->opened = 0;
-    msleep(10);
-
-    mutex_destroy(&inf->rlock);
-    mutex_destroy(&inf->wlock);
+    if ((atomic_read(&pool->total) < READ_ONCE(pool->max)) &&
+        !atomic_xchg(&pool->grow, 1)) {
+        mod_delayed_work(pool->mxlk->wq, &pool->resize, 0);
+    }
+}
 
-    mxlk_free_rx_bd(inf->mxlk, inf->partial_read);
-    while ((bd = mxlk_list_get(&inf->read))) {
-        mxlk_free_rx_bd(inf->mxlk, bd);
+static void mxlk_pool_put(struct mxlk *mxlk, struct mxlk_pool *pool,
+                          struct mxlk_buf_desc *bd)
+{
+    /* Pools are sized for all their bds, this is not expected to fail */
+    if (mxlk_ring_push(&pool->ring, bd)) {
+        mx_err("pool full, dropping buf desc %px\n", bd);
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_pool_drops, 1);
+        mxlk_free_bd(mxlk, bd);
+        atomic_dec(&pool->total);
     }
 }
 
-static void mxlk_add_bd_to_interface(struct mxlk *mxlk, struct mxlk_buf_desc *bd)
+static struct mxlk_buf_desc *mxlk_pool_get(struct mxlk_pool *pool)
 {
-    struct mxlk_interface *inf;
+    struct mxlk_bd_cache *cache;
+    struct mxlk_buf_desc *bd = NULL;
 
-    inf = mxlk->interfaces + bd->interface;
+    if (!pool->caches) {
+        bd = mxlk_ring_pop(&pool->ring);
+        if (!bd) {
+            trace_mxlk_pool_empty(pool, 1, 0);
+        }
+        if (!bd || (mxlk_ring_count(&pool->ring) <
+                    atomic_read(&pool->total) / 8)) {
+            mxlk_pool_request_grow(pool);
+        }
+        return bd;
+    }
+
+    cache = get_cpu_ptr(pool->caches);
+    if (!cache->count) {
+        cache->count = mxlk_ring_pop_bulk(&pool->ring, cache->bds,
+                                          pool->batch);
+        /* Below the low watermark, or dry: ask for more */
+        if (!cache->count || (mxlk_ring_count(&pool->ring) <
+                              atomic_read(&pool->total) / 8)) {
+            mxlk_pool_request_grow(pool);
+        }
+    }
+    if (cache->count) {
+        bd = cache->bds[--cache->count];
+    }
+    put_cpu_ptr(pool->caches);
+
+    if (!bd) {
+        trace_mxlk_pool_empty(pool, 1, 0);
+    }
 
-    mxlk_list_put(&inf->read, bd);
-    /* Wake up read wait queue in case someone is waiting for RX data */
-    wake_up(&inf->rd_waitq);
+    return bd;
 }
 
-static int mxlk_discover_txrx(struct mxlk *mxlk)
+static void mxlk_pool_free(struct mxlk *mxlk, struct mxlk_pool *pool,
+                           struct mxlk_buf_desc *bd)
 {
-    int error;
-    struct mxlk_cap_txrx *cap;
+    int flushed;
+    struct mxlk_bd_cache *cache;
 
-    cap = mxlk_cap_find(mxlk, 0, MXLK_CAP_TXRX);
-    if (cap) {
-        error = mxlk_txrx_init(mxlk, cap);
-    } else {
-        error = -EIO;
+    if (!pool->caches) {
+        mxlk_pool_put(mxlk, pool, bd);
+        return;
     }
 
-    return error;
-}
+    cache = get_cpu_ptr(pool->caches);
+    if (cache->count >= pool->cache_size) {
+        /* Hand the coldest bds back, keep the recently used ones */
+        flushed = mxlk_ring_push_bulk(&pool->ring, cache->bds, pool->batch);
+        cache->count -= flushed;
+        memmove(cache->bds, cache->bds + flushed,
+                cache->count * sizeof(cache->bds[0]));
+    }
+    if (cache->count < pool->cache_size) {
+        cache->bds[cache->count++] = bd;
+        bd = NULL;
+    }
+    put_cpu_ptr(pool->caches);
 
-static void mxlk_set_td_address(struct mxlk_transfer_desc *td, u64 address)
-{
-    mx_wr64(td, offsetof(struct mxlk_transfer_desc, address), address);
+    if (bd) {
+        mxlk_pool_put(mxlk, pool, bd);
+    }
 }
 
-static u64 mxlk_get_td_address(struct mxlk_transfer_desc *td)
+static size_t mxlk_pool_count(struct mxlk_pool *pool)
 {
-    return mx_rd64(td, offsetof(struct mxlk_transfer_desc, address));
-}
+    int cpu;
+    size_t count = mxlk_ring_count(&pool->ring);
 
-static void mxlk_set_td_length(struct mxlk_transfer_desc *td, u32 length)
-{
-    mx_wr32(td, offsetof(struct mxlk_transfer_desc, length), length);
-}
+    if (pool->caches) {
+        for_each_possible_cpu(cpu) {
+            count += READ_ONCE(per_cpu_ptr(pool->caches, cpu)->count);
+        }
+    }
 
-static u32  mxlk_get_td_length(struct mxlk_transfer_desc *td)
-{
-    return mx_rd32(td, offsetof(struct mxlk_transfer_desc, length));
+    return count;
 }
 
-static void mxlk_set_td_interface(struct mxlk_transfer_desc *td, u16 interface)
+/*
+ * Takes up to count bds, from the local CPU cache first, then from the shared
+ * ring a batch at a time
+ */
+static int mxlk_pool_get_bulk(struct mxlk_pool *pool,
+                              struct mxlk_buf_desc **bds, int count)
 {
-    mx_wr16(td, offsetof(struct mxlk_transfer_desc, interface), interface);
-}
+    int got = 0, popped;
+    struct mxlk_bd_cache *cache;
 
-static u16  mxlk_get_td_interface(struct mxlk_transfer_desc *td)
-{
-    return mx_rd16(td, offsetof(struct mxlk_transfer_desc, interface));
-}
+    if (pool->caches) {
+        cache = get_cpu_ptr(pool->caches);
+        while ((got < count) && cache->count) {
+            bds[got++] = cache->bds[--cache->count];
+        }
+        put_cpu_ptr(pool->caches);
+    }
 
-static void mxlk_set_td_status(struct mxlk_transfer_desc *td, u16 status)
-{
-    mx_wr16(td, offsetof(struct mxlk_transfer_desc, status), status);
-}
+    while (got < count) {
+        popped = mxlk_ring_pop_bulk(&pool->ring, bds + got, count - got);
+        if (!popped) {
+            break;
+        }
+        got += popped;
+    }
 
-static u16  mxlk_get_td_status(struct mxlk_transfer_desc *td)
-{
-    return mx_rd16(td, offsetof(struct mxlk_transfer_desc, status));
-}
+    if (got < count) {
+        trace_mxlk_pool_empty(pool, count, got);
+    }
+    if ((got < count) ||
+        (mxlk_ring_count(&pool->ring) < atomic_read(&pool->total) / 8)) {
+        mxlk_pool_request_grow(pool);
+    }
 
-static void mxlk_set_tdr_head(struct mxlk_pipe *p, u32 head)
-{
-    mx_wr32(p->head, 0, head);
+    return got;
 }
 
-static u32  mxlk_get_tdr_head(struct mxlk_pipe *p)
+/*
+ * Returns count bds, topping up the local CPU cache first and handing the
+ * rest to the shared ring a batch at a time
+ */
+static void mxlk_pool_free_bulk(struct mxlk *mxlk, struct mxlk_pool *pool,
+                                struct mxlk_buf_desc **bds, int count)
 {
-    return mx_rd32(p->head, 0);
+    int pushed;
+    struct mxlk_bd_cache *cache;
+
+    if (pool->caches) {
+        cache = get_cpu_ptr(pool->caches);
+        while (count && (cache->count < pool->cache_size)) {
+            cache->bds[cache->count++] = *bds++;
+            count--;
+        }
+        put_cpu_ptr(pool->caches);
+    }
+
+    while (count) {
+        pushed = mxlk_ring_push_bulk(&pool->ring, bds, count);
+        if (!pushed) {
+            mxlk_pool_put(mxlk, pool, *bds++);
+            count--;
+            continue;
+        }
+        bds += pushed;
+        count -= pushed;
+    }
 }
 
-static void mxlk_set_tdr_tail(struct mxlk_pipe *p, u32 tail)
+static void mxlk_bd_list_init(struct mxlk_bd_list *list)
 {
-    mx_wr32(p->tail, 0, tail);
+    list->head = NULL;
+    list->tail = NULL;
+    list->count = 0;
 }
 
-static u32  mxlk_get_tdr_tail(struct mxlk_pipe *p)
+static void mxlk_bd_list_add(struct mxlk_bd_list *list,
+                             struct mxlk_buf_desc *bd)
 {
-    return mx_rd32(p->tail, 0);
+    bd->next = NULL;
+    if (list->tail) {
+        list->tail->next = bd;
+    } else {
+        list->head = bd;
+    }
+    list->tail = bd;
+    list->count++;
 }
 
-static int mxlk_txrx_init(struct mxlk *mxlk, struct mxlk_cap_txrx *cap)
+/* Moves all of other to the end of list, leaving other empty */
+static void mxlk_bd_list_splice(struct mxlk_bd_list *list,
+                                struct mxlk_bd_list *other)
 {
-    int index;
-    int ndesc;
-    struct mxlk_stream *tx = &mxlk->tx;
-    struct mxlk_stream *rx = &mxlk->rx;
-
-    mxlk->txrx = cap;
-    mxlk->fragment_size = mx_rd32(&cap->fragment_size, 0);
-
-    tx->busy = 0;
-    tx->pipe.ndesc = mx_rd32(&cap->tx.ndesc, 0);
-    tx->pipe.head  = &cap->tx.head;
-    tx->pipe.tail  = &cap->tx.tail;
-    tx->pipe.old   = mx_rd32(&cap->tx.tail, 0);
-    tx->pipe.tdr   = mxlk->mmio + mx_rd32(&cap->tx.ring, 0);
-
-    tx->ddr = kzalloc(sizeof(struct mxlk_dma_desc) * tx->pipe.ndesc, GFP_KERNEL);
-    if (!tx->ddr) {
-        mx_err("failed to alloc tx dma desc ring\n");
-        goto error;
+    if (!other->head) {
+        return;
     }
 
-    rx->busy = 0;
-    rx->pipe.ndesc = mx_rd32(&cap->rx.ndesc, 0);
-    rx->pipe.head  = &cap->rx.head;
-    rx->pipe.tail  = &cap->rx.tail;
-    rx->pipe.old   = mx_rd32(&cap->tx.head, 0);
-    rx->pipe.tdr   = mxlk->mmio + mx_rd32(&cap->rx.ring, 0);
-
-    rx->ddr = kzalloc(sizeof(struct mxlk_dma_desc) * rx->pipe.ndesc, GFP_KERNEL);
-    if (!rx->ddr) {
-        mx_err("failed to alloc rx dma desc ring\n");
-        goto error;
+    if (list->tail) {
+        list->tail->next = other->head;
+    } else {
+        list->head = other->head;
     }
+    list->tail = other->tail;
+    list->count += other->count;
 
-    mxlk_list_init(&mxlk->rx_pool);
-    rx_pool_size = roundup(rx_pool_size,  mxlk->fragment_size);
-    ndesc = rx_pool_size / mxlk->fragment_size;
-
-    for (index = 0; index < ndesc; index++) {
-        struct mxlk_buf_desc *bd = mxlk_alloc_bd(mxlk->fragment_size);
-        if (bd) {
-            mxlk_list_put(&mxlk->rx_pool, bd);
-        } else {
-            mx_err("failed to alloc all rx pool descriptors\n");
-            goto error;
-        }
-    }
+    mxlk_bd_list_init(other);
+}
 
-    mxlk_list_init(&mxlk->tx_pool);
-    tx_pool_size = roundup(tx_pool_size,  mxlk->fragment_size);
-    ndesc = tx_pool_size / mxlk->fragment_size;
+/*
+ * Pool buffers are page backed: a fragment over half a page gets its own
+ * compound page, smaller ones are carved cache line aligned out of a shared
+ * page, each holding a page reference. Buffers are mapped once and recycled
+ * through the pool, mapping intact, until the pool shrinks or goes away.
+ * Called from pool init and resize only, never concurrently for a pool.
+ */
+static struct mxlk_buf_desc *mxlk_alloc_bd(struct mxlk_pool *pool)
+{
+    struct mxlk *mxlk = pool->mxlk;
+    struct device *dev = MXLK_TO_DEV(mxlk);
+    size_t length = mxlk->fragment_size;
+    size_t stride = roundup(length, cache_line_size());
+    struct mxlk_buf_desc *bd;
+    struct page *page;
+    unsigned int offset = 0;
 
-    for (index = 0; index < ndesc; index++) {
-        struct mxlk_buf_desc *bd = mxlk_alloc_bd(mxlk->fragment_size);
-        if (bd) {
-            mxlk_list_put(&mxlk->tx_pool, bd);
-        } else {
-            mx_err("failed to alloc all tx pool descriptors\n");
-            goto error;
-        }
+    bd = kzalloc(sizeof(*bd), GFP_KERNEL);
+    if (!bd) {
+        return NULL;
     }
 
-    for (index = 0; index < rx->pipe.ndesc; index++) {
-        struct mxlk_buf_desc *bd = mxlk_alloc_rx_bd(mxlk);
-        struct mxlk_dma_desc *dd = rx->ddr + index;
-        struct mxlk_transfer_desc *td = rx->pipe.tdr + index;
-
-        if (!bd) {
-            mx_err("failed to alloc rx ring buf desc [%d]\n", index);
-            goto error;
+    if (stride > PAGE_SIZE / 2) {
+        page = alloc_pages(GFP_KERNEL | __GFP_ZERO | __GFP_COMP,
+                           get_order(length));
+        if (!page) {
+            goto error_page;
         }
-
-        dd->bd = bd;
-        if (mxlk_map_dma(mxlk, dd, DMA_FROM_DEVICE)) {
-            mx_err("failed to map rx bd\n");
-            goto error;
+    } else {
+        if (pool->frag_page && (pool->frag_offset + stride > PAGE_SIZE)) {
+            put_page(pool->frag_page);
+            pool->frag_page = NULL;
+        }
+        if (!pool->frag_page) {
+            pool->frag_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+            if (!pool->frag_page) {
+                goto error_page;
+            }
+            pool->frag_offset = 0;
         }
+        page = pool->frag_page;
+        offset = pool->frag_offset;
+        pool->frag_offset += stride;
+        get_page(page);
+    }
 
-        mxlk_set_td_address(td, dd->phys);
-        mxlk_set_td_length(td, dd->length);
+    /* Mapped once for the lifetime of the buffer, the data path only syncs */
+    bd->phys = dma_map_page(dev, page, offset, length, pool->direction);
+    if (dma_mapping_error(dev, bd->phys)) {
+        put_page(page);
+        goto error_page;
     }
+    bd->direction = pool->direction;
 
-    return 0;
+    bd->page = page;
+    bd->head = page_address(page) + offset;
+    bd->data = bd->head;
+    bd->length = bd->true_len = length;
+    bd->next = NULL;
 
-error :
-    mxlk_txrx_cleanup(mxlk);
+    return bd;
 
-    return -1;
+error_page:
+    kfree(bd);
+
+    return NULL;
 }
 
-static void mxlk_txrx_cleanup(struct mxlk *mxlk)
+static void mxlk_free_bd(struct mxlk *mxlk, struct mxlk_buf_desc *bd)
 {
-    int index;
-    struct mxlk_stream *tx = &mxlk->tx;
-    struct mxlk_stream *rx = &mxlk->rx;
-
-    if (tx->ddr) {
-        for (index = 0; index < tx->pipe.ndesc; index++) {
-            struct mxlk_dma_desc *dd = tx->ddr + index;
-            if (dd->bd) {
-                mxlk_unmap_dma(mxlk, dd, DMA_TO_DEVICE);
-                mxlk_free_tx_bd(mxlk, dd->bd);
-            }
-        }
-        kfree(tx->ddr);
-    }
-
-    if (rx->ddr) {
-        for (index = 0; index < rx->pipe.ndesc; index++) {
-            struct mxlk_dma_desc *dd = rx->ddr + index;
-            struct mxlk_transfer_desc *td = rx->pipe.tdr + index;
-            if (dd->bd) {
-                mxlk_unmap_dma(mxlk, dd, DMA_FROM_DEVICE);
-                mxlk_free_rx_bd(mxlk, dd->bd);
-                mxlk_set_td_address(td, 0);
-                mxlk_set_td_length(td, 0);
-            }
-        }
-        kfree(rx->ddr);
+    if (bd && bd->zc) {
+        /* dropped before being sent, fail the write it belongs to */
+        mxlk_zc_bd_done(mxlk, bd, -EIO);
+    } else if (bd) {
+        dma_unmap_page(MXLK_TO_DEV(mxlk), bd->phys, bd->true_len,
+                       bd->direction);
+        put_page(bd->page);
+        kfree(bd);
     }
-
-    mxlk_list_cleanup(&mxlk->tx_pool);
-    mxlk_list_cleanup(&mxlk->rx_pool);
 }
 
-static irqreturn_t mxlk_interrupt(int irq, void *args)
+static struct mxlk_buf_desc *mxlk_alloc_rx_bd(struct mxlk *mxlk)
 {
-    struct mxlk *mxlk = args;
-    enum mx_opmode opmode;
+    struct mxlk_buf_desc *bd;
 
-    opmode = mx_get_opmode(&mxlk->mx_dev);
-    if (opmode == MX_OPMODE_APP_VPULINK) {
-        mxlk->stats.interrupts++;
-        mxlk_start_tx(mxlk);
-        mxlk_start_rx(mxlk);
-    } else if (opmode == MX_OPMODE_BOOT) {
-        mx_wr32(mxlk->mmio, MX_INT_IDENTITY, 0);
-    } else {
-        mx_err("Unexpected MSI interrupt in operation mode %d\n", opmode);
+    bd = mxlk_pool_get(&mxlk->rx_pool);
+    if (bd) {
+        mxlk_reset_bd(bd);
     }
 
-    return IRQ_HANDLED;
+    return bd;
 }
 
-#if MXLK_IRQ_VECTORS != 1
-#error "mxlk requested irqs mismatch!"
-#endif
-
-static int mxlk_events_init(struct mxlk *mxlk)
+static void mxlk_free_rx_bd(struct mxlk *mxlk, struct mxlk_buf_desc * bd)
 {
-    int error;
-
-    INIT_WORK(&mxlk->rx_event, mxlk_rx_event_handler);
-    INIT_WORK(&mxlk->tx_event, mxlk_tx_event_handler);
-    INIT_WORK(&mxlk->send_doorbell, mxlk_send_doorbell_handler);
-
-    error = mx_pci_irq_init(&mxlk->mx_dev, MXLK_DRIVER_NAME, mxlk_interrupt, mxlk);
-    if (error) {
-        return error;
+    if (bd) {
+        mxlk_pool_free(mxlk, &mxlk->rx_pool, bd);
     }
+}
 
-    /* Allow some time for the device to complete initialization after MSI
-     * enable handshake. */
-    msleep(50);
+static struct mxlk_buf_desc *mxlk_alloc_tx_bd(struct mxlk *mxlk)
+{
+    struct mxlk_buf_desc *bd;
 
-    if (mx_get_opmode(&mxlk->mx_dev) == MX_OPMODE_BOOT) {
-        mx_boot_status_update_int_enable(&mxlk->mx_dev);
+    bd = mxlk_pool_get(&mxlk->tx_pool);
+    if (bd) {
+        mxlk_reset_bd(bd);
     }
 
-    return 0;
+    return bd;
 }
 
-static void mxlk_events_cleanup(struct mxlk *mxlk)
+static void mxlk_free_tx_bd(struct mxlk *mxlk, struct mxlk_buf_desc * bd)
 {
-    if (mx_get_opmode(&mxlk->mx_dev) == MX_OPMODE_BOOT) {
-       mx_boot_status_update_int_disable(&mxlk->mx_dev);
+    if (bd && bd->zc) {
+        /* only reached for bds that never completed on the device */
+        mxlk_zc_bd_done(mxlk, bd, -EIO);
+    } else if (bd) {
+        mxlk_pool_free(mxlk, &mxlk->tx_pool, bd);
     }
-    mx_pci_irq_cleanup(&mxlk->mx_dev, mxlk);
-
-    cancel_work_sync(&mxlk->send_doorbell);
-    cancel_work_sync(&mxlk->rx_event);
-    cancel_work_sync(&mxlk->tx_event);
 }
 
-static void mxlk_send_doorbell_handler(struct work_struct *work)
+static void mxlk_reset_bd(struct mxlk_buf_desc *bd)
 {
-    struct mxlk *mxlk = container_of(work, struct mxlk, send_doorbell);
-
-    mxlk_ring_doorbell(mxlk);
+    bd->data = bd->head;
+    bd->length = bd->true_len;
+    bd->next = NULL;
+    bd->interface = -1;
+    bd->flags = 0;
+    bd->msg_len = 0;
 }
 
-static int mxlk_map_dma(struct mxlk *mxlk, struct mxlk_dma_desc *dd,
-                        int direction)
+static int mxlk_alloc_rx_bds(struct mxlk *mxlk, struct mxlk_buf_desc **bds,
+                             int count)
 {
-    struct device *dev = MXLK_TO_DEV(mxlk);
+    int index, got;
 
-    dd->phys = dma_map_single(dev, dd->bd->data, dd->bd->length, direction);
-    dd->length = dd->bd->length;
+    got = mxlk_pool_get_bulk(&mxlk->rx_pool, bds, count);
+    for (index = 0; index < got; index++) {
+        mxlk_reset_bd(bds[index]);
+    }
 
-    return dma_mapping_error(dev, dd->phys);
+    return got;
 }
 
-static void mxlk_unmap_dma(struct mxlk *mxlk, struct mxlk_dma_desc *dd,
-                           int direction)
+/* Appends up to count TX bds to list, returns the number appended */
+static int mxlk_alloc_tx_bds(struct mxlk *mxlk, struct mxlk_bd_list *list,
+                             int count)
 {
-    struct device *dev = MXLK_TO_DEV(mxlk);
+    int index, want, got, total = 0;
+    struct mxlk_buf_desc *bds[MXLK_BD_CACHE_SIZE];
+    struct mxlk_bd_list batch;
+
+    while (total < count) {
+        want = min_t(int, count - total, ARRAY_SIZE(bds));
+        got = mxlk_pool_get_bulk(&mxlk->tx_pool, bds, want);
+
+        mxlk_bd_list_init(&batch);
+        for (index = 0; index < got; index++) {
+            mxlk_reset_bd(bds[index]);
+            mxlk_bd_list_add(&batch, bds[index]);
+        }
+        mxlk_bd_list_splice(list, &batch);
+
+        total += got;
+        if (got < want) {
+            break;
+        }
+    }
 
-    dma_unmap_single(dev, dd->phys, dd->length, direction);
+    return total;
 }
 
-static void mxlk_rx_event_handler(struct work_struct *work)
+/* Returns a chain of pool bds to pool, leaving list empty */
+static void mxlk_free_bd_list(struct mxlk *mxlk, struct mxlk_pool *pool,
+                              struct mxlk_bd_list *list)
 {
-    struct mxlk *mxlk = container_of(work, struct mxlk, rx_event);
+    int count = 0;
+    struct mxlk_buf_desc *bds[MXLK_BD_CACHE_SIZE];
+    struct mxlk_buf_desc *bd = list->head;
 
-    int error, restart = 0;
-    u16 status, interface;
-    u32 head, tail, ndesc, length;
-    struct mxlk_stream *rx = &mxlk->rx;
-    struct mxlk_buf_desc *bd, *replacement;
-    struct mxlk_dma_desc *dd;
-    struct mxlk_transfer_desc *td;
+    while (bd) {
+        bds[count++] = bd;
+        bd = bd->next;
+        if (count == ARRAY_SIZE(bds)) {
+            mxlk_pool_free_bulk(mxlk, pool, bds, count);
+            count = 0;
+        }
+    }
+    mxlk_pool_free_bulk(mxlk, pool, bds, count);
 
-    mxlk->stats.rx_event_runs++;
+    mxlk_bd_list_init(list);
+}
 
-    ndesc =  rx->pipe.ndesc;
-    tail  = mxlk_get_tdr_tail(&rx->pipe);
-    head  = mxlk_get_tdr_head(&rx->pipe);
+static void mxlk_zc_bd_done(struct mxlk *mxlk, struct mxlk_buf_desc *bd,
+                            int error)
+{
+    struct mxlk_zc *zc = bd->zc;
 
-    /* Stop processing here in case MX device is down. */
-    if (INVALID(head) || INVALID(tail)) {
-        return;
+    if (error) {
+        zc->error = error;
     }
+    kfree(bd);
 
-    /* clean old entries first */
-    while (head != tail) {
-        td = rx->pipe.tdr + head;
-        dd = rx->ddr + head;
-
-        replacement = mxlk_alloc_rx_bd(mxlk);
-        if (!replacement) {
-            restart = 1;
-            break;
-        }
-
-        status = mxlk_get_td_status(td);
-        interface = mxlk_get_td_interface(td);
-        length = mxlk_get_td_length(td);
-        mxlk_unmap_dma(mxlk, dd, DMA_FROM_DEVICE);
+    /* the writer may have left already, the bds then hold the last ref */
+    if (atomic_dec_and_test(&zc->pending)) {
+        wake_up(&mxlk->wr_waitq);
+        mxlk_zc_put(mxlk, zc);
+    }
+}
 
-        if (unlikely(status != MXLK_DESC_STATUS_SUCCESS)) {
-            mxlk_free_rx_bd(mxlk, dd->bd);
-        } else {
-            bd = dd->bd;
-            bd->interface = interface;
-            bd->length = length;
-            bd->next = NULL;
+static int mxlk_all_chrdev_init(struct mxlk *mxlk)
+{
+    int error;
+    int index;
+    struct mxlk_interface *inf;
 
-            if (likely(interface < MXLK_NUM_INTERFACES)) {
-                mxlk->stats.rx_krn.pkts++;
-                mxlk->stats.rx_krn.bytes += bd->length;
-                mxlk_add_bd_to_interface(mxlk, bd);
-            } else {
-                mxlk_free_rx_bd(mxlk, bd);
-            }
+    init_waitqueue_head(&mxlk->wr_waitq);
+    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
+        inf = mxlk->interfaces + index;
+        /* Set mxlk pointer now because it used by mxlk_chrdev_add(). The rest
+         * of the interface structure will be initialized later. */
+        inf->mxlk = mxlk;
+        /* Locks and wait queues outlive comms resets, users may hold them */
+        mutex_init(&inf->rlock);
+        mutex_init(&inf->wlock);
+        init_waitqueue_head(&inf->rd_waitq);
+        error = mxlk_chrdev_add(inf);
+        if (error) {
+            return error;
         }
+    }
 
-        dd->bd = replacement;
-        error = mxlk_map_dma(mxlk, dd, DMA_FROM_DEVICE);
+    return 0;
+}
+
+static void mxlk_all_chrdev_cleanup(struct mxlk *mxlk)
+{
+    int index;
+    struct mxlk_interface *inf;
+
+    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
+        inf = mxlk->interfaces + index;
+        mxlk_chrdev_remove(inf);
+        mutex_destroy(&inf->rlock);
+        mutex_destroy(&inf->wlock);
+    }
+}
+
+static int mxlk_interfaces_init(struct mxlk *mxlk)
+{
+    int index;
+    int error;
+
+    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
+        error = mxlk_interface_init(mxlk, index);
         if (error) {
-            mx_err("failed to map rx bd (%d)\n", error);
+            while (index--) {
+                mxlk_interface_cleanup(mxlk->interfaces + index);
+            }
+            return error;
         }
+    }
 
-        mxlk_set_td_address(td, dd->phys);
-        mxlk_set_td_length(td, dd->length);
-        head = MXLK_CIRCULAR_INC(head, ndesc);
+    return 0;
+}
+
+static void mxlk_interfaces_cleanup(struct mxlk *mxlk)
+{
+    int index;
+
+    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
+        mxlk_interface_cleanup(mxlk->interfaces + index);
     }
+}
 
-    if (mxlk_get_tdr_head(&rx->pipe) != head) {
-        mxlk_set_tdr_head(&rx->pipe, head);
-        wmb();
-        mxlk_send_doorbell(mxlk);
+static int mxlk_interface_init(struct mxlk *mxlk, int id)
+{
+    int error;
+    struct mxlk_interface *inf = mxlk->interfaces + id;
+
+    /* Room for every RX buffer, the read queue can then never overflow */
+    error = mxlk_ring_init(&inf->read, mxlk->rx_pool.ring.mask + 1);
+    if (error) {
+        mx_err("failed to alloc read queue of interface %d\n", id);
+        return error;
     }
 
-    if (unlikely(restart)) {
-        msleep(5);
-        mxlk_start_rx(mxlk);
+    inf->id = id;
+    inf->opened = 0;
+
+    inf->partial_read = NULL;
+    mxlk_bd_list_init(&inf->rx_msg);
+    inf->rx_msg_drop = false;
+    inf->datagram = false;
+    inf->tx_pending = NULL;
+    inf->coalesce = 0;
+    INIT_DELAYED_WORK(&inf->flush, mxlk_flush_event_handler);
+    inf->fd_busy_poll = -1;
+    inf->rcvtimeo = 0;
+    inf->sndtimeo = 0;
+    inf->rcvlowat = 0;
+    inf->rcvwant = 0;
+    inf->sndlowat = 0;
+    inf->txq = 0;
+    atomic_set(&inf->tx_inflight, 0);
+    atomic_set(&inf->read_bytes, 0);
+    atomic_set(&inf->read_msgs, 0);
+
+    return 0;
+}
+
+static void mxlk_interface_cleanup(struct mxlk_interface *inf)
+{
+    struct mxlk_buf_desc *bd;
+
+    inf->opened = 0;
+    msleep(10);
+
+    /* Readers and writers were woken and see the link down, wait for them
+     * to leave before freeing what they use */
+    cancel_delayed_work_sync(&inf->flush);
+    mutex_lock(&inf->wlock);
+    mxlk_free_tx_bd(inf->mxlk, inf->tx_pending);
+    inf->tx_pending = NULL;
+    inf->coalesce = 0;
+    mutex_unlock(&inf->wlock);
+    /* a writer may have armed it again before it saw the link down */
+    cancel_delayed_work_sync(&inf->flush);
+
+    mutex_lock(&inf->rlock);
+    mxlk_free_rx_bd(inf->mxlk, inf->partial_read);
+    inf->partial_read = NULL;
+    while ((bd = mxlk_ring_pop(&inf->read))) {
+        mxlk_free_rx_bd(inf->mxlk, bd);
     }
+    mxlk_free_bd_list(inf->mxlk, &inf->mxlk->rx_pool, &inf->rx_msg);
+    mxlk_ring_cleanup(&inf->read);
+    mutex_unlock(&inf->rlock);
 }
 
-static void mxlk_tx_event_handler(struct work_struct *work)
+static void mxlk_add_bd_to_interface(struct mxlk *mxlk, struct mxlk_buf_desc *bd)
 {
-    struct mxlk *mxlk = container_of(work, struct mxlk, tx_event);
+    struct mxlk_interface *inf;
+    struct mxlk_bd_list record;
 
-    u16 status;
-    u32 head, tail, old, ndesc;
-    struct mxlk_stream *tx = &mxlk->tx;
+    inf = mxlk->interfaces + bd->interface;
+
+    /* Stream data is a record of its own */
+    if (!bd->flags) {
+        mxlk_bd_list_init(&record);
+        mxlk_bd_list_add(&record, bd);
+        mxlk_add_record_to_interface(mxlk, inf, &record);
+        return;
+    }
+
+    /* Messages are held back until complete. A new start drops a message
+     * left unfinished, a fragment with no message started is dropped. */
+    if (bd->flags & MXLK_DESC_FLAG_SOM) {
+        if (inf->rx_msg.count) {
+            mxlk_stats_add(mxlk->stats, MXLK_STAT_rx_drops_msg, 1);
+            mxlk_free_bd_list(mxlk, &mxlk->rx_pool, &inf->rx_msg);
+        }
+        inf->rx_msg_drop = false;
+    } else if (inf->rx_msg_drop) {
+        /* rest of a message already counted as dropped */
+        inf->rx_msg_drop = !(bd->flags & MXLK_DESC_FLAG_EOM);
+        mxlk_free_rx_bd(mxlk, bd);
+        return;
+    } else if (!inf->rx_msg.count) {
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_rx_drops_msg, 1);
+        mxlk_free_rx_bd(mxlk, bd);
+        return;
+    }
+
+    /* Messages over the limit are dropped, see mxlk_txrx_init() */
+    if (inf->rx_msg.count >= mxlk->msg_max_bds) {
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_rx_drops_msg, 1);
+        mxlk_free_bd_list(mxlk, &mxlk->rx_pool, &inf->rx_msg);
+        inf->rx_msg_drop = !(bd->flags & MXLK_DESC_FLAG_EOM);
+        mxlk_free_rx_bd(mxlk, bd);
+        return;
+    }
+
+    mxlk_bd_list_add(&inf->rx_msg, bd);
+    if (bd->flags & MXLK_DESC_FLAG_EOM) {
+        mxlk_add_record_to_interface(mxlk, inf, &inf->rx_msg);
+        mxlk_bd_list_init(&inf->rx_msg);
+    }
+}
+
+/*
+ * Queues a record, a stream bd or a complete message, for the reader. Its
+ * first bd carries the record length and its last bd marks the end, so the
+ * reader only needs to look at the bds it pops.
+ */
+static void mxlk_add_record_to_interface(struct mxlk *mxlk,
+                                         struct mxlk_interface *inf,
+                                         struct mxlk_bd_list *record)
+{
+    struct mxlk_buf_desc *bd, *next, *last = NULL;
+    unsigned int queued, want;
+    size_t length = 0;
+
+    for (bd = record->head; bd; bd = next) {
+        next = bd->next;
+        if (mxlk_ring_push(&inf->read, bd)) {
+            break;
+        }
+        length += bd->length;
+        last = bd;
+    }
+
+    /* Cannot happen as long as the read queue holds every RX buffer */
+    if (bd) {
+        mx_err("read queue of interface %d full\n", inf->id);
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_read_queue_drops, 1);
+        for (; bd; bd = next) {
+            next = bd->next;
+            mxlk_free_rx_bd(mxlk, bd);
+        }
+        if (!last) {
+            return;
+        }
+        /* close what made it in, the reader must find the end */
+        if (last->flags) {
+            last->flags |= MXLK_DESC_FLAG_EOM;
+        }
+    }
+    record->head->msg_len = length;
+
+    /* Count only once queued, readers must never see bytes they cannot pop */
+    queued = atomic_add_return(length, &inf->read_bytes);
+    atomic_inc(&inf->read_msgs);
+
+    /* Wake up readers once there is enough RX data for them */
+    want = READ_ONCE(inf->rcvwant);
+    if (READ_ONCE(inf->datagram) ||
+        (queued >= (want ? want : max(READ_ONCE(inf->rcvlowat), 1U)))) {
+        wake_up(&inf->rd_waitq);
+    }
+}
+
+/* Sends the fragment left partly filled by small writes, with wlock held */
+static void mxlk_flush_pending(struct mxlk_interface *inf)
+{
+    struct mxlk_buf_desc *bd = inf->tx_pending;
+
+    if (!bd) {
+        return;
+    }
+    inf->tx_pending = NULL;
+
+    if (inf->mxlk->status != MXLK_STATUS_RUN) {
+        mxlk_free_tx_bd(inf->mxlk, bd);
+        return;
+    }
+
+    mxlk_queue_write(inf, bd, 1, bd->stamp);
+}
+
+static void mxlk_flush_event_handler(struct work_struct *work)
+{
+    struct mxlk_interface *inf = container_of(to_delayed_work(work),
+                                              struct mxlk_interface, flush);
+
+    mutex_lock(&inf->wlock);
+    if (inf->tx_pending) {
+        mxlk_stats_add(inf->mxlk->stats, MXLK_STAT_tx_flushes, 1);
+        mxlk_flush_pending(inf);
+    }
+    mutex_unlock(&inf->wlock);
+}
+
+static void mxlk_busy_poll(struct mxlk_interface *inf, unsigned int usecs)
+{
+    struct mxlk *mxlk = inf->mxlk;
+    u64 end = local_clock() + (u64) usecs * NSEC_PER_USEC;
+    bool restart = false;
+    int index;
+
+    mxlk_stats_add(mxlk->stats, MXLK_STAT_busy_polls, 1);
+
+    /* Harvest the RX ring from the reader's context instead of waiting for
+     * the interrupt and work item to deliver the data. */
+    while (!mxlk_core_read_data_available(inf)) {
+        for (index = 0; index < mxlk->num_queues; index++) {
+            /* spinning, not sleeping behind the RX work */
+            mxlk_rx_process(mxlk->queues + index, mxlk->poll_budget,
+                            &restart, true);
+        }
+        if (mxlk_core_read_data_available(inf)) {
+            mxlk_stats_add(mxlk->stats, MXLK_STAT_busy_poll_hits, 1);
+            break;
+        }
+
+        if (restart || need_resched() || signal_pending(current) ||
+            (local_clock() >= end)) {
+            break;
+        }
+        cpu_relax();
+    }
+}
+
+static struct mxlk_queue *mxlk_select_txq(struct mxlk_interface *inf)
+{
+    int qid;
+    struct mxlk *mxlk = inf->mxlk;
+
+    if (mxlk->num_queues <= 1) {
+        qid = 0;
+    } else if (mxlk->queue_select == MXLK_QUEUE_SELECT_INTERFACE) {
+        /* all on queue 0 as long as MXLK_NUM_INTERFACES is 1 */
+        qid = inf->id % mxlk->num_queues;
+    } else {
+        qid = raw_smp_processor_id() % mxlk->num_queues;
+    }
+
+    /* Only move the interface once everything it sent on its current queue
+     * completed, so its data cannot be reordered across queues. */
+    if ((qid != inf->txq) && !atomic_read(&inf->tx_inflight)) {
+        inf->txq = qid;
+    }
+
+    return mxlk->queues + inf->txq;
+}
+
+static void mxlk_queue_write(struct mxlk_interface *inf,
+                             struct mxlk_buf_desc *head, int nbds, u64 stamp)
+{
+    struct mxlk_queue *queue = mxlk_select_txq(inf);
+    struct mxlk *mxlk = inf->mxlk;
     struct mxlk_buf_desc *bd;
-    struct mxlk_dma_desc *dd;
-    struct mxlk_transfer_desc *td;
-    bool buffer_freed = false;
+    bool drop = false;
+
+    atomic_add(nbds, &inf->tx_inflight);
+    while (head) {
+        bd = head;
+        head = bd->next;
+        bd->next = NULL;
+        bd->stamp = stamp;
+
+        /* Write queues are sized for the TX pool plus a zero-copy write, a
+         * longer write waits for the ring to take some. Data is only dropped
+         * once the link is down or the writer is being killed, and then
+         * the whole rest of the write so that no gap is ever sent. */
+        while (!drop && mxlk_spsc_push(&queue->write[inf->id], bd)) {
+            mxlk_start_tx(queue);
+            drop = wait_event_killable(mxlk->wr_waitq,
+                        (mxlk_spsc_count(&queue->write[inf->id]) <=
+                         queue->write[inf->id].mask) ||
+                        (mxlk->status != MXLK_STATUS_RUN)) ||
+                   (mxlk->status != MXLK_STATUS_RUN);
+        }
+        if (drop) {
+            mxlk_stats_add(mxlk->stats, MXLK_STAT_write_queue_drops, 1);
+            atomic_dec(&inf->tx_inflight);
+            mxlk_free_tx_bd(mxlk, bd);
+        }
+    }
+    mxlk_start_tx(queue);
+}
+
+static void mxlk_discover_stats(struct mxlk *mxlk)
+{
+    struct mxlk_cap_stats *cap;
+
+    /* Device counters are optional, host stats are kept regardless */
+    cap = mxlk_cap_find(mxlk, 0, MXLK_CAP_STATS);
+    if (!cap) {
+        WRITE_ONCE(mxlk->cap_stats, NULL);
+        return;
+    }
+
+    WRITE_ONCE(mxlk->cap_stats_num, mx_rd16(&cap->num_counters, 0));
+    WRITE_ONCE(mxlk->cap_stats, cap);
+
+    mx_info("device stats, counters : %d\n", mxlk->cap_stats_num);
+}
+
+static int mxlk_discover_txrx(struct mxlk *mxlk)
+{
+    int error;
+    struct mxlk_cap_txrx *cap;
+
+    cap = mxlk_cap_find(mxlk, 0, MXLK_CAP_TXRX);
+    if (cap) {
+        error = mxlk_txrx_init(mxlk, cap);
+    } else {
+        error = -EIO;
+    }
+
+    return error;
+}
+
+static void mxlk_discover_txrx_ext(struct mxlk *mxlk)
+{
+    u32 features;
+    int max_queues, queues;
+    struct mxlk_cap_txrx_ext *cap;
+
+    mxlk->features = 0;
+    mxlk->num_queues = 1;
+
+    /* Older firmware does not expose the capability: keep legacy behavior */
+    cap = mxlk_cap_find(mxlk, 0, MXLK_CAP_TXRX_EXT);
+    mxlk->txrx_ext = cap;
+    if (!cap) {
+        return;
+    }
+
+    features = mx_rd32(&cap->features, 0);
+
+    /* Per event MSIs are only usable if we got all the vectors at init */
+    if ((features & MXLK_TXRX_FEATURE_MULTI_MSI) &&
+        (mxlk->mx_dev.irq_vectors >= MXLK_IRQ_VECTORS)) {
+        mx_wr16(&cap->msi_vectors, 0, mxlk->mx_dev.irq_vectors);
+        mxlk->features |= MXLK_TXRX_FEATURE_MULTI_MSI;
+    }
+
+    if (features & MXLK_TXRX_FEATURE_MULTI_QUEUE) {
+        max_queues = min_t(int, mx_rd16(&cap->max_queues, 0), MXLK_MAX_QUEUES);
+        queues = (num_queues > 0) ? num_queues : num_online_cpus();
+        queues = clamp(queues, 1, max_queues);
+        if (queues > 1) {
+            mx_wr16(&cap->num_queues, 0, queues);
+            mxlk->features |= MXLK_TXRX_FEATURE_MULTI_QUEUE;
+            mxlk->num_queues = queues;
+        }
+    }
+
+    if (features & MXLK_TXRX_FEATURE_MSG_FLAGS) {
+        mxlk->features |= MXLK_TXRX_FEATURE_MSG_FLAGS;
+    }
+
+    mx_wr32(&cap->enabled, 0, mxlk->features);
+
+    mx_info("txrx features, dev : 0x%x, enabled : 0x%x, queues : %d\n",
+            features, mxlk->features, mxlk->num_queues);
+}
+
+static void mxlk_discover_txrx_host(struct mxlk *mxlk)
+{
+    int max_queues;
+    struct mxlk_cap_txrx_host *cap;
+
+    mxlk->txrx_host = NULL;
+    if (!host_rings) {
+        return;
+    }
+
+    /* Without the capability, rings stay in BAR2 */
+    cap = mxlk_cap_find(mxlk, 0, MXLK_CAP_TXRX_HOST);
+    if (!cap) {
+        return;
+    }
+
+    max_queues = mx_rd16(&cap->max_queues, 0);
+    if (max_queues < mxlk->num_queues) {
+        mx_info("host rings for %d queues only, rings kept in BAR\n",
+                max_queues);
+        return;
+    }
+
+    mxlk->txrx_host = cap;
+}
+
+static void mxlk_set_td_address(struct mxlk_transfer_desc *td, u64 address)
+{
+    mx_wr64(td, offsetof(struct mxlk_transfer_desc, address), address);
+}
+
+static u64 mxlk_get_td_address(struct mxlk_transfer_desc *td)
+{
+    return mx_rd64(td, offsetof(struct mxlk_transfer_desc, address));
+}
+
+static void mxlk_set_td_length(struct mxlk_transfer_desc *td, u32 length)
+{
+    mx_wr32(td, offsetof(struct mxlk_transfer_desc, length), length);
+}
+
+static u32  mxlk_get_td_length(struct mxlk_transfer_desc *td)
+{
+    return mx_rd32(td, offsetof(struct mxlk_transfer_desc, length));
+}
+
+static void mxlk_set_td_interface(struct mxlk_transfer_desc *td, u16 interface)
+{
+    mx_wr16(td, offsetof(struct mxlk_transfer_desc, interface), interface);
+}
+
+static u16  mxlk_get_td_interface(struct mxlk_transfer_desc *td)
+{
+    return mx_rd16(td, offsetof(struct mxlk_transfer_desc, interface));
+}
+
+static void mxlk_set_td_status(struct mxlk_transfer_desc *td, u16 status)
+{
+    mx_wr16(td, offsetof(struct mxlk_transfer_desc, status), status);
+}
+
+static u16  mxlk_get_td_status(struct mxlk_transfer_desc *td)
+{
+    return mx_rd16(td, offsetof(struct mxlk_transfer_desc, status));
+}
+
+/*
+ * Status of a descriptor returned by the device. With rings in host memory,
+ * the MMIO read of the index that returned it orders this read after the
+ * device writes.
+ */
+static u16 mxlk_get_ring_status(struct mxlk_pipe *p, u32 index)
+{
+    struct mxlk_transfer_desc *td = p->tdr + index;
+
+    if (p->host) {
+        return le16_to_cpu(td->status);
+    }
+
+    return mxlk_get_td_status(td);
+}
+
+/*
+ * Length, status and interface of a descriptor, written by the device, as
+ * they lie in the upper half of the descriptor. One MMIO read where the
+ * platform has 64-bit reads, none with rings in host memory.
+ */
+#ifdef readq
+#define MXLK_TD_COMPLETION_READS    (1)
+#else
+#define MXLK_TD_COMPLETION_READS    (2)
+#endif
+
+static u64 mxlk_get_td_completion(struct mxlk_pipe *p, u32 index)
+{
+    struct mxlk_transfer_desc *td = p->tdr + index;
+    u64 status;
+
+    BUILD_BUG_ON(offsetof(struct mxlk_transfer_desc, length) != sizeof(u64));
+
+    /* The device writes the status last: read it first, so that a returned
+     * packed descriptor is never seen with a stale length */
+    if (p->host) {
+        status = le16_to_cpu(td->status);
+        dma_rmb();
+        return le32_to_cpu(td->length) | (status << 32) |
+               ((u64) le16_to_cpu(td->interface) << 48);
+    }
+
+#ifdef readq
+    return readq((void __iomem *) td +
+                 offsetof(struct mxlk_transfer_desc, length));
+#else
+    status = mx_rd32(td, offsetof(struct mxlk_transfer_desc, status));
+    return mx_rd32(td, offsetof(struct mxlk_transfer_desc, length)) |
+           (status << 32);
+#endif
+}
+
+/*
+ * Packed format ownership of a descriptor. The host hands a descriptor over
+ * with AVAIL set to its wrap counter and USED to the opposite, the device
+ * returns it with both set to the wrap counter it had when it took it.
+ */
+static u16 mxlk_td_avail_status(struct mxlk_pipe *p, u16 code)
+{
+    return (code & MXLK_DESC_STATUS_CODE_MASK) |
+           (p->avail_wrap ? MXLK_DESC_STATUS_AVAIL : MXLK_DESC_STATUS_USED);
+}
+
+static bool mxlk_td_is_used(struct mxlk_pipe *p, u16 status)
+{
+    u16 owner = status & (MXLK_DESC_STATUS_AVAIL | MXLK_DESC_STATUS_USED);
+
+    return owner == (p->used_wrap ?
+                     (MXLK_DESC_STATUS_AVAIL | MXLK_DESC_STATUS_USED) : 0);
+}
+
+#define MXLK_TD_COMPLETION_LENGTH(c)    ((u32) (c))
+#define MXLK_TD_COMPLETION_STATUS(c)    ((u16) ((c) >> 32))
+#define MXLK_TD_COMPLETION_INTERFACE(c) ((u16) ((c) >> 48))
+
+/*
+ * Fills a descriptor in host memory, in the device byte order. The status
+ * goes last, as it hands packed descriptors staged in place over.
+ */
+static void mxlk_stage_td(struct mxlk_transfer_desc *td, u64 address,
+                          u32 length, u16 interface, u16 status)
+{
+    td->address = cpu_to_le64(address);
+    td->length = cpu_to_le32(length);
+    td->interface = cpu_to_le16(interface);
+    dma_wmb();
+    td->status = cpu_to_le16(status);
+}
+
+/*
+ * Copies staged descriptors from..to (excluded) into the ring, one burst per
+ * contiguous range, and fences so they land before the index publishing them
+ */
+static void mxlk_write_tds(struct mxlk_pipe *p,
+                           struct mxlk_transfer_desc *stage, u32 from, u32 to)
+{
+    const size_t size = sizeof(struct mxlk_transfer_desc);
+    const size_t status = offsetof(struct mxlk_transfer_desc, status);
+    const size_t interface = offsetof(struct mxlk_transfer_desc, interface);
+    u32 start = from;
+
+    if (from == to) {
+        return;
+    }
+
+    /* Host memory rings are staged in place */
+    if (p->host) {
+        wmb();
+        return;
+    }
+
+    /* The device takes packed descriptors in order, so the whole batch is
+     * handed over by the status of the first one, written once all else
+     * has landed */
+    if (p->packed) {
+        from = MXLK_CIRCULAR_INC(from, p->ndesc);
+    }
+
+    if (to < from) {
+        mx_wr_buf(p->tdr_wc, from * size, stage + from,
+                  (p->ndesc - from) * size);
+        from = 0;
+    }
+    if (to > from) {
+        mx_wr_buf(p->tdr_wc, from * size, stage + from, (to - from) * size);
+    }
+
+    if (p->packed) {
+        mx_wr_buf(p->tdr_wc, start * size, stage + start, status);
+        mx_wr_buf(p->tdr_wc, start * size + interface,
+                  &stage[start].interface, sizeof(u16));
+        wmb();
+        mx_wr_buf(p->tdr_wc, start * size + status,
+                  &stage[start].status, sizeof(u16));
+    }
+
+    wmb();
+}
+
+/*
+ * Descriptor rings are only written in bursts, map them write-combined so
+ * those reach the device as few large transactions. Keeps the uncached
+ * mapping if that fails.
+ */
+static void mxlk_pipe_map_wc(struct mxlk *mxlk, struct mxlk_pipe *p,
+                             u32 offset)
+{
+    resource_size_t start;
+
+    p->tdr_wc = p->tdr;
+    if (!p->ndesc) {
+        return;
+    }
+
+    start = pci_resource_start(MXLK_TO_PCI(mxlk), MXLK_MMIO_BAR) + offset;
+    p->tdr_wc = ioremap_wc(start, p->ndesc * sizeof(struct mxlk_transfer_desc));
+    if (!p->tdr_wc) {
+        mx_info("ring at 0x%x not write-combined\n", offset);
+        p->tdr_wc = p->tdr;
+    }
+}
+
+static void mxlk_pipe_unmap_wc(struct mxlk_pipe *p)
+{
+    if (p->tdr_wc && (p->tdr_wc != p->tdr)) {
+        iounmap(p->tdr_wc);
+    }
+    p->tdr_wc = NULL;
+}
+
+static int mxlk_pipe_alloc_host(struct mxlk *mxlk, struct mxlk_pipe *p)
+{
+    p->tdr = dma_alloc_coherent(MXLK_TO_DEV(mxlk),
+                                p->ndesc * sizeof(struct mxlk_transfer_desc),
+                                &p->phys, GFP_KERNEL);
+    if (!p->tdr) {
+        return -ENOMEM;
+    }
+    p->host = true;
+
+    return 0;
+}
+
+static void mxlk_pipe_free_host(struct mxlk *mxlk, struct mxlk_pipe *p)
+{
+    if (p->host) {
+        /* a device still fetching from them would read freed memory */
+        if (!mxlk->host_rings_held) {
+            dma_free_coherent(MXLK_TO_DEV(mxlk),
+                              p->ndesc * sizeof(struct mxlk_transfer_desc),
+                              p->tdr, p->phys);
+        }
+        p->host = false;
+        p->tdr = NULL;
+    }
+}
+
+static void mxlk_set_tdr_head(struct mxlk_pipe *p, u32 head)
+{
+    mx_wr32(p->head, 0, head);
+}
+
+static u32  mxlk_get_tdr_head(struct mxlk_pipe *p)
+{
+    return mx_rd32(p->head, 0);
+}
+
+static void mxlk_set_tdr_tail(struct mxlk_pipe *p, u32 tail)
+{
+    mx_wr32(p->tail, 0, tail);
+}
+
+static u32  mxlk_get_tdr_tail(struct mxlk_pipe *p)
+{
+    return mx_rd32(p->tail, 0);
+}
+
+static int mxlk_txrx_init(struct mxlk *mxlk, struct mxlk_cap_txrx *cap)
+{
+    int index, qid;
+    int ndesc, tx_ndesc, rx_max, tx_max, ring_ndesc = 0;
+    size_t write_size;
+    struct mxlk_queue *queue;
+    struct mxlk_cap_queue *qcap = NULL;
+    struct mxlk_cap_host_rings *hcap = NULL;
+
+    mxlk->txrx = cap;
+    mxlk->fragment_size = mx_rd32(&cap->fragment_size, 0);
+
+    tx_ndesc = DIV_ROUND_UP(tx_pool_size, mxlk->fragment_size);
+    tx_max = max_t(int, tx_ndesc, tx_pool_max / mxlk->fragment_size);
+
+    /* A write queue holds at most the whole TX pool and one zero-copy write */
+    write_size = tx_max + MXLK_ZC_MAX_LEN / PAGE_SIZE +
+                 MXLK_ZC_MAX_LEN / mxlk->fragment_size + 2;
+
+    /* Queue 0 is described by the txrx cap, others by the extended one */
+    if (mxlk->features & MXLK_TXRX_FEATURE_MULTI_QUEUE) {
+        qcap = mxlk->mmio + mx_rd32(&mxlk->txrx_ext->queues, 0);
+    }
+
+    for (qid = 0; qid < mxlk->num_queues; qid++) {
+        queue = mxlk->queues + qid;
+        if (mxlk->txrx_host) {
+            hcap = mxlk->txrx_host->queues + qid;
+        }
+        if (qid == 0) {
+            index = mxlk_queue_init(queue, &cap->tx, &cap->rx, hcap,
+                                    write_size);
+        } else {
+            index = mxlk_queue_init(queue, &qcap[qid - 1].tx,
+                                    &qcap[qid - 1].rx, hcap, write_size);
+        }
+        if (index) {
+            goto error;
+        }
+        ring_ndesc += queue->rx.pipe.ndesc;
+    }
+
+    ndesc = DIV_ROUND_UP(rx_pool_size, mxlk->fragment_size);
+
+    /* Leave as many buffers for the readers as all RX rings hold */
+    if (ndesc < 2 * ring_ndesc) {
+        mx_info("rx pool grown to %d buffers for %d queues\n",
+                2 * ring_ndesc, mxlk->num_queues);
+        ndesc = 2 * ring_ndesc;
+    }
+
+    rx_max = max_t(int, ndesc, rx_pool_max / mxlk->fragment_size);
+
+    if (mxlk_pool_init(mxlk, &mxlk->rx_pool, DMA_FROM_DEVICE, ndesc, rx_max)) {
+        mx_err("failed to alloc rx pool\n");
+        goto error;
+    }
+
+    /* Half the RX pool as first sized, a larger message would starve the
+     * ring it has yet to arrive through. Writes are held to it as well. */
+    mxlk->msg_max_bds = max(ndesc / 2, 1);
+
+    if (mxlk_pool_init(mxlk, &mxlk->tx_pool, DMA_TO_DEVICE, tx_ndesc, tx_max)) {
+        mx_err("failed to alloc tx pool\n");
+        goto error;
+    }
+
+    for (qid = 0; qid < mxlk->num_queues; qid++) {
+        struct mxlk_stream *rx = &mxlk->queues[qid].rx;
+
+        for (index = 0; index < rx->pipe.ndesc; index++) {
+            struct mxlk_buf_desc *bd = mxlk_alloc_rx_bd(mxlk);
+            struct mxlk_dma_desc *dd = rx->ddr + index;
+
+            if (!bd) {
+                mx_err("failed to alloc rx ring %d buf desc [%d]\n",
+                       qid, index);
+                goto error;
+            }
+
+            dd->bd = bd;
+            mxlk_sync_dma_for_device(mxlk, dd, DMA_FROM_DEVICE);
+
+            /* handed over in the first lap if packed */
+            mxlk_stage_td(rx->stage + index, dd->phys, dd->length, 0,
+                          rx->pipe.packed ? MXLK_DESC_STATUS_AVAIL : 0);
+        }
+        mxlk_write_tds(&rx->pipe, rx->stage, 0, rx->pipe.ndesc);
+    }
+
+    if (mxlk->txrx_host) {
+        mx_wr16(&mxlk->txrx_host->enabled, 0, 1);
+        mx_info("descriptor rings in host memory\n");
+    }
+
+    return 0;
+
+error :
+    mxlk_txrx_cleanup(mxlk);
+
+    return -1;
+}
+
+static void mxlk_txrx_cleanup(struct mxlk *mxlk)
+{
+    int qid;
+    unsigned long timeout;
+
+    /* The device must be done with host rings before they are freed */
+    mxlk->host_rings_held = false;
+    if (mxlk->txrx_host) {
+        mx_wr16(&mxlk->txrx_host->enabled, 0, 0);
+        timeout = jiffies + msecs_to_jiffies(MXLK_HOST_RINGS_RELEASE_MS);
+        while (mx_rd16(&mxlk->txrx_host->active, 0)) {
+            if (time_after(jiffies, timeout)) {
+                mx_err("device kept host rings, leaking them\n");
+                mxlk->host_rings_held = true;
+                break;
+            }
+            msleep(1);
+        }
+        mxlk->txrx_host = NULL;
+    }
+
+    for (qid = 0; qid < MXLK_MAX_QUEUES; qid++) {
+        mxlk_queue_cleanup(mxlk->queues + qid);
+    }
+
+    /* Buffers are unmapped when freed out of the pools */
+    mxlk_pool_cleanup(mxlk, &mxlk->tx_pool);
+    mxlk_pool_cleanup(mxlk, &mxlk->rx_pool);
+}
+
+static int mxlk_queue_init(struct mxlk_queue *queue,
+                           struct mxlk_cap_pipe *tx_cap,
+                           struct mxlk_cap_pipe *rx_cap,
+                           struct mxlk_cap_host_rings *host_cap,
+                           size_t write_size)
+{
+    int index;
+    struct mxlk *mxlk = queue->mxlk;
+    struct mxlk_stream *tx = &queue->tx;
+    struct mxlk_stream *rx = &queue->rx;
+
+    mutex_init(&tx->lock);
+    mutex_init(&rx->lock);
+    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
+        if (mxlk_spsc_init(&queue->write[index], write_size)) {
+            mx_err("failed to alloc write queue %d of queue %d\n",
+                   index, queue->id);
+            return -ENOMEM;
+        }
+        queue->deficit[index] = 0;
+    }
+    queue->drr_next = 0;
+
+    tx->busy = 0;
+    tx->pipe.ndesc = mx_rd32(&tx_cap->ndesc, 0);
+    tx->pipe.head  = &tx_cap->head;
+    tx->pipe.tail  = &tx_cap->tail;
+    tx->pipe.old   = mx_rd32(&tx_cap->tail, 0);
+    tx->pipe.shadow = tx->pipe.old;
+    tx->pipe.packed = mxlk->packed;
+    if (tx->pipe.packed) {
+        tx->pipe.old = tx->pipe.shadow = 0;
+        tx->pipe.avail_wrap = tx->pipe.used_wrap = true;
+    }
+    tx->pipe.tdr   = mxlk->mmio + mx_rd32(&tx_cap->ring, 0);
+
+    tx->ddr = kzalloc(sizeof(struct mxlk_dma_desc) * tx->pipe.ndesc, GFP_KERNEL);
+    if (!tx->ddr) {
+        mx_err("failed to alloc tx dma desc ring %d\n", queue->id);
+        return -ENOMEM;
+    }
+
+    if (host_cap) {
+        if (mxlk_pipe_alloc_host(mxlk, &tx->pipe)) {
+            mx_err("failed to alloc tx host ring %d\n", queue->id);
+            return -ENOMEM;
+        }
+        tx->stage = tx->pipe.tdr;
+        mx_wr64(&host_cap->tx, 0, tx->pipe.phys);
+    } else {
+        tx->stage = kcalloc(tx->pipe.ndesc, sizeof(struct mxlk_transfer_desc),
+                            GFP_KERNEL);
+        if (!tx->stage) {
+            mx_err("failed to alloc tx staging ring %d\n", queue->id);
+            return -ENOMEM;
+        }
+        mxlk_pipe_map_wc(mxlk, &tx->pipe, mx_rd32(&tx_cap->ring, 0));
+    }
+
+    rx->busy = 0;
+    rx->pipe.ndesc = mx_rd32(&rx_cap->ndesc, 0);
+    rx->pipe.head  = &rx_cap->head;
+    rx->pipe.tail  = &rx_cap->tail;
+    rx->pipe.old   = mx_rd32(&rx_cap->head, 0);
+    rx->pipe.shadow = mx_rd32(&rx_cap->head, 0);
+    rx->pipe.packed = mxlk->packed;
+    if (rx->pipe.packed) {
+        /* the whole ring is posted once at init, a lap ahead of the head */
+        rx->pipe.shadow = 0;
+        rx->pipe.avail_wrap = false;
+        rx->pipe.used_wrap = true;
+    }
+    rx->pipe.tdr   = mxlk->mmio + mx_rd32(&rx_cap->ring, 0);
+
+    rx->ddr = kzalloc(sizeof(struct mxlk_dma_desc) * rx->pipe.ndesc, GFP_KERNEL);
+    if (!rx->ddr) {
+        mx_err("failed to alloc rx dma desc ring %d\n", queue->id);
+        return -ENOMEM;
+    }
+
+    if (host_cap) {
+        if (mxlk_pipe_alloc_host(mxlk, &rx->pipe)) {
+            mx_err("failed to alloc rx host ring %d\n", queue->id);
+            return -ENOMEM;
+        }
+        rx->stage = rx->pipe.tdr;
+        mx_wr64(&host_cap->rx, 0, rx->pipe.phys);
+    } else {
+        rx->stage = kcalloc(rx->pipe.ndesc, sizeof(struct mxlk_transfer_desc),
+                            GFP_KERNEL);
+        if (!rx->stage) {
+            mx_err("failed to alloc rx staging ring %d\n", queue->id);
+            return -ENOMEM;
+        }
+        mxlk_pipe_map_wc(mxlk, &rx->pipe, mx_rd32(&rx_cap->ring, 0));
+    }
+
+    return 0;
+}
+
+static void mxlk_queue_cleanup(struct mxlk_queue *queue)
+{
+    int index;
+    struct mxlk *mxlk = queue->mxlk;
+    struct mxlk_stream *tx = &queue->tx;
+    struct mxlk_stream *rx = &queue->rx;
+
+    if (!tx->ddr && !rx->ddr && !queue->write[0].bds) {
+        return;
+    }
+
+    cancel_work_sync(&queue->rx_event);
+    cancel_work_sync(&queue->tx_event);
+    kthread_cancel_work_sync(&queue->rx_kwork);
+    kthread_cancel_work_sync(&queue->tx_kwork);
+
+    if (tx->ddr) {
+        for (index = 0; index < tx->pipe.ndesc; index++) {
+            struct mxlk_dma_desc *dd = tx->ddr + index;
+            if (dd->bd) {
+                mxlk_free_tx_bd(mxlk, dd->bd);
+            }
+        }
+        kfree(tx->ddr);
+        tx->ddr = NULL;
+    }
+
+    if (rx->ddr) {
+        for (index = 0; index < rx->pipe.ndesc; index++) {
+            struct mxlk_dma_desc *dd = rx->ddr + index;
+            struct mxlk_transfer_desc *td = rx->pipe.tdr + index;
+            if (dd->bd) {
+                mxlk_free_rx_bd(mxlk, dd->bd);
+                if (!rx->pipe.host) {
+                    mxlk_set_td_address(td, 0);
+                    mxlk_set_td_length(td, 0);
+                }
+            }
+        }
+        kfree(rx->ddr);
+        rx->ddr = NULL;
+    }
+
+    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
+        struct mxlk_spsc *write = &queue->write[index];
+        struct mxlk_buf_desc *bd;
+
+        if (!write->bds) {
+            continue;
+        }
+        while ((bd = mxlk_spsc_pop(write))) {
+            mxlk_free_tx_bd(mxlk, bd);
+        }
+        mxlk_spsc_cleanup(write);
+    }
+
+    mxlk_pipe_unmap_wc(&tx->pipe);
+    mxlk_pipe_unmap_wc(&rx->pipe);
+    if (!tx->pipe.host) {
+        kfree(tx->stage);
+    }
+    tx->stage = NULL;
+    if (!rx->pipe.host) {
+        kfree(rx->stage);
+    }
+    rx->stage = NULL;
+    mxlk_pipe_free_host(mxlk, &tx->pipe);
+    mxlk_pipe_free_host(mxlk, &rx->pipe);
+
+    mutex_destroy(&tx->lock);
+    mutex_destroy(&rx->lock);
+}
+
+static irqreturn_t mxlk_interrupt(int irq, void *args)
+{
+    struct mxlk *mxlk = args;
+    enum mx_opmode opmode;
+
+    opmode = mx_get_opmode(&mxlk->mx_dev);
+    if (opmode == MX_OPMODE_APP_VPULINK) {
+        mxlk_stats_irq(mxlk->stats);
+        trace_mxlk_irq(mxlk, irq);
+        if (mxlk->features & MXLK_TXRX_FEATURE_MULTI_MSI) {
+            /* RX and TX completions have their own vectors */
+            queue_work(mxlk->wq, &mxlk->status_event);
+        } else if (mxlk->poll_mode) {
+            mxlk_poll_schedule(mxlk);
+        } else {
+            mxlk_start_all(mxlk);
+        }
+    } else if (opmode == MX_OPMODE_BOOT) {
+        mx_wr32(mxlk->mmio, MX_INT_IDENTITY, 0);
+    } else {
+        mx_err("Unexpected MSI interrupt in operation mode %d\n", opmode);
+    }
+
+    return IRQ_HANDLED;
+}
+
+static irqreturn_t mxlk_rx_interrupt(int irq, void *args)
+{
+    struct mxlk *mxlk = args;
+    int index, nvec;
+
+    if (likely(mxlk->features & MXLK_TXRX_FEATURE_MULTI_MSI)) {
+        mxlk_stats_irq(mxlk->stats);
+        trace_mxlk_irq(mxlk, irq);
+        if (mxlk->poll_mode) {
+            mxlk_poll_schedule(mxlk);
+        } else {
+            /* irqs were looked up at init, pci_irq_vector() may sleep */
+            nvec = mxlk->mx_dev.irq_vectors;
+            for (index = 0; index < mxlk->num_queues; index++) {
+                if (mxlk->irqs[MXLK_IRQ_VECTOR_RXQ(index, nvec)] == irq) {
+                    mxlk_start_rx(mxlk->queues + index);
+                }
+            }
+        }
+    }
+
+    return IRQ_HANDLED;
+}
+
+static irqreturn_t mxlk_tx_interrupt(int irq, void *args)
+{
+    struct mxlk *mxlk = args;
+    int index, nvec;
+
+    if (likely(mxlk->features & MXLK_TXRX_FEATURE_MULTI_MSI)) {
+        mxlk_stats_irq(mxlk->stats);
+        trace_mxlk_irq(mxlk, irq);
+        if (mxlk->poll_mode) {
+            mxlk_poll_schedule(mxlk);
+        } else {
+            /* irqs were looked up at init, pci_irq_vector() may sleep */
+            nvec = mxlk->mx_dev.irq_vectors;
+            for (index = 0; index < mxlk->num_queues; index++) {
+                if (mxlk->irqs[MXLK_IRQ_VECTOR_TXQ(index, nvec)] == irq) {
+                    mxlk_start_tx(mxlk->queues + index);
+                }
+            }
+        }
+    }
+
+    return IRQ_HANDLED;
+}
+
+static int mxlk_events_init(struct mxlk *mxlk)
+{
+    int error;
+    int index;
+    irq_handler_t isrs[MXLK_IRQ_VECTORS_MAX];
+
+    isrs[MXLK_IRQ_VECTOR_STATUS] = mxlk_interrupt;
+    for (index = 0; index < MXLK_MAX_QUEUES; index++) {
+        struct mxlk_queue *queue = mxlk->queues + index;
+
+        isrs[MXLK_IRQ_VECTOR_RXQ(index, MXLK_IRQ_VECTORS_MAX)] =
+            mxlk_rx_interrupt;
+        isrs[MXLK_IRQ_VECTOR_TXQ(index, MXLK_IRQ_VECTORS_MAX)] =
+            mxlk_tx_interrupt;
+
+        queue->id = index;
+        queue->mxlk = mxlk;
+        INIT_WORK(&queue->rx_event, mxlk_rx_event_handler);
+        INIT_WORK(&queue->tx_event, mxlk_tx_event_handler);
+        kthread_init_work(&queue->rx_kwork, mxlk_rx_kwork_handler);
+        kthread_init_work(&queue->tx_kwork, mxlk_tx_kwork_handler);
+    }
+
+    INIT_WORK(&mxlk->status_event, mxlk_status_event_handler);
+    INIT_WORK(&mxlk->send_doorbell, mxlk_send_doorbell_handler);
+    INIT_WORK(&mxlk->poll, mxlk_poll_handler);
+    kthread_init_work(&mxlk->poll_kwork, mxlk_poll_kwork_handler);
+    mxlk->poll_state = 0;
+
+    error = mxlk_service_init(mxlk);
+    if (error) {
+        return error;
+    }
+
+    /* Multi message MSI is not available on all platforms. Try a vector pair
+     * per queue first, then a pair shared by all queues. With a single
+     * vector, mxlk_interrupt() signals all events as before. */
+    error = mx_pci_irq_vectors_init(&mxlk->mx_dev, MXLK_DRIVER_NAME, isrs,
+                                    MXLK_IRQ_VECTORS_MAX, mxlk);
+    if (error) {
+        error = mx_pci_irq_vectors_init(&mxlk->mx_dev, MXLK_DRIVER_NAME, isrs,
+                                        MXLK_IRQ_VECTORS, mxlk);
+    }
+    if (error) {
+        mx_info("falling back to a single MSI vector\n");
+        error = mx_pci_irq_init(&mxlk->mx_dev, MXLK_DRIVER_NAME,
+                                mxlk_interrupt, mxlk);
+        if (error) {
+            mxlk_service_cleanup(mxlk);
+            return error;
+        }
+    }
+
+    /* Looked up once for the handlers, pci_irq_vector() may sleep. No queue
+     * is in use yet, so no handler looks before they are set. */
+    for (index = 0; index < mxlk->mx_dev.irq_vectors; index++) {
+        mxlk->irqs[index] = pci_irq_vector(mxlk->pci, index);
+    }
+
+    /* Allow some time for the device to complete initialization after MSI
+     * enable handshake. */
+    msleep(50);
+
+    if (mx_get_opmode(&mxlk->mx_dev) == MX_OPMODE_BOOT) {
+        mx_boot_status_update_int_enable(&mxlk->mx_dev);
+    }
+
+    return 0;
+}
+
+static void mxlk_events_cleanup(struct mxlk *mxlk)
+{
+    int index;
+
+    if (mx_get_opmode(&mxlk->mx_dev) == MX_OPMODE_BOOT) {
+       mx_boot_status_update_int_disable(&mxlk->mx_dev);
+    }
+    mxlk_poll_stop(mxlk);
+    mx_pci_irq_cleanup(&mxlk->mx_dev, mxlk);
+
+    cancel_work_sync(&mxlk->send_doorbell);
+    for (index = 0; index < MXLK_MAX_QUEUES; index++) {
+        cancel_work_sync(&mxlk->queues[index].rx_event);
+        cancel_work_sync(&mxlk->queues[index].tx_event);
+        kthread_cancel_work_sync(&mxlk->queues[index].rx_kwork);
+        kthread_cancel_work_sync(&mxlk->queues[index].tx_kwork);
+    }
+    cancel_work_sync(&mxlk->status_event);
+    cancel_work_sync(&mxlk->poll);
+    kthread_cancel_work_sync(&mxlk->poll_kwork);
+    mxlk_service_cleanup(mxlk);
+}
+
+static void mxlk_send_doorbell_handler(struct work_struct *work)
+{
+    struct mxlk *mxlk = container_of(work, struct mxlk, send_doorbell);
+
+    mxlk_ring_doorbell(mxlk);
+}
+
+static void mxlk_sync_dma_for_device(struct mxlk *mxlk,
+                                     struct mxlk_dma_desc *dd, int direction)
+{
+    struct mxlk_buf_desc *bd = dd->bd;
+
+    dd->phys = bd->phys + (bd->data - bd->head);
+    dd->length = bd->length;
+
+    /* zero-copy bds are mapped as a scatterlist just before being posted */
+    if (!bd->zc) {
+        dma_sync_single_for_device(MXLK_TO_DEV(mxlk), dd->phys, dd->length,
+                                   direction);
+    }
+}
+
+static void mxlk_sync_dma_for_cpu(struct mxlk *mxlk, struct mxlk_dma_desc *dd,
+                                  size_t length, int direction)
+{
+    dma_sync_single_for_cpu(MXLK_TO_DEV(mxlk), dd->phys,
+                            min(length, dd->length), direction);
+}
+
+/*
+ * Reaps up to budget descriptors of a RX ring and posts fresh buffers in their
+ * place. With nowait, a ring whose lock is held is skipped: its owner is
+ * reaping it already.
+ */
+static int mxlk_rx_process(struct mxlk_queue *queue, int budget,
+                           bool *restart, bool nowait)
+{
+    int done = 0;
+    u16 status, interface, flags;
+    u32 head, first, tail, ndesc, length;
+    u64 completion;
+    struct mxlk *mxlk = queue->mxlk;
+    struct mxlk_stream *rx = &queue->rx;
+    struct mxlk_buf_desc *bd, *replacement;
+    struct mxlk_buf_desc *spare[MXLK_BD_CACHE_SIZE];
+    int nspare = 0, used = 0;
+    u64 bytes = 0, now;
+    int pkts = 0, drops_status = 0, drops_interface = 0, mmio_reads = 0;
+    bool refill_failed = false;
+    struct mxlk_bd_list dropped;
+    struct mxlk_dma_desc *dd;
+
+    if (nowait) {
+        if (!mutex_trylock(&rx->lock)) {
+            return 0;
+        }
+    } else {
+        mutex_lock(&rx->lock);
+    }
+    mxlk_bd_list_init(&dropped);
+
+    /* Only the device owned tail is read back, the head is ours. Packed
+     * rings have no tail, returned descriptors are told by their status. */
+    ndesc =  rx->pipe.ndesc;
+    head  = rx->pipe.shadow;
+    tail  = head;
+    if (!rx->pipe.packed) {
+        tail = mxlk_get_tdr_tail(&rx->pipe);
+        mmio_reads++;
+
+        /* Stop processing here in case MX device is down. */
+        if (INVALID(tail)) {
+            mutex_unlock(&rx->lock);
+            mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_mmio_reads,
+                                 mmio_reads);
+            return 0;
+        }
+    }
+
+    now = ktime_get_ns();
+    trace_mxlk_rx_start(queue, budget);
+
+    /* clean old entries first, refilled descriptors are staged and written
+     * back to the ring in one burst at the end of the pass. A packed pass
+     * stops one short of a full lap: a head back at first would write and
+     * hand back nothing. */
+    if (rx->pipe.packed) {
+        budget = min_t(u32, budget, ndesc - 1);
+    }
+    first = head;
+    while ((rx->pipe.packed || head != tail) && done < budget) {
+        dd = rx->ddr + head;
+
+        completion = mxlk_get_td_completion(&rx->pipe, head);
+        if (!rx->pipe.host) {
+            mmio_reads += MXLK_TD_COMPLETION_READS;
+        }
+        status = MXLK_TD_COMPLETION_STATUS(completion);
+        if (rx->pipe.packed) {
+            /* all ones once the device is down */
+            if ((completion == ~0ULL) ||
+                !mxlk_td_is_used(&rx->pipe, status)) {
+                break;
+            }
+            status &= MXLK_DESC_STATUS_CODE_MASK;
+        }
+
+        /* Replacements are taken from the pool a batch at a time */
+        if (used == nspare) {
+            nspare = min_t(u32, ARRAY_SIZE(spare), budget - done);
+            if (!rx->pipe.packed) {
+                nspare = min_t(u32, nspare, (tail + ndesc - head) % ndesc);
+            }
+            nspare = mxlk_alloc_rx_bds(mxlk, spare, nspare);
+            used = 0;
+            if (!nspare) {
+                refill_failed = true;
+                *restart = true;
+                break;
+            }
+        }
+        replacement = spare[used++];
+
+        length = MXLK_TD_COMPLETION_LENGTH(completion);
+        interface = MXLK_TD_COMPLETION_INTERFACE(completion);
+        mxlk_sync_dma_for_cpu(mxlk, dd, length, DMA_FROM_DEVICE);
+
+        flags = 0;
+        if (mxlk->features & MXLK_TXRX_FEATURE_MSG_FLAGS) {
+            flags = interface & MXLK_DESC_FLAGS_MASK;
+            interface &= ~MXLK_DESC_FLAGS_MASK;
+        }
+
+        if (unlikely(status != MXLK_DESC_STATUS_SUCCESS)) {
+            mxlk_bd_list_add(&dropped, dd->bd);
+            drops_status++;
+        } else {
+            bd = dd->bd;
+            bd->interface = interface;
+            bd->length = length;
+            bd->flags = flags;
+            bd->next = NULL;
+            bd->stamp = now;
+
+            if (likely(interface < MXLK_NUM_INTERFACES)) {
+                pkts++;
+                bytes += bd->length;
+                mxlk_add_bd_to_interface(mxlk, bd);
+            } else {
+                mxlk_bd_list_add(&dropped, bd);
+                drops_interface++;
+            }
+        }
+
+        dd->bd = replacement;
+        mxlk_sync_dma_for_device(mxlk, dd, DMA_FROM_DEVICE);
+
+        /* status and interface go back as the device left them, packed
+         * descriptors are handed over again for the next lap */
+        if (rx->pipe.packed) {
+            status = mxlk_td_avail_status(&rx->pipe, MXLK_DESC_STATUS_SUCCESS);
+        }
+        mxlk_stage_td(rx->stage + head, dd->phys, dd->length,
+                      MXLK_TD_COMPLETION_INTERFACE(completion), status);
+        head = MXLK_CIRCULAR_INC(head, ndesc);
+        if (!head) {
+            rx->pipe.avail_wrap = !rx->pipe.avail_wrap;
+            rx->pipe.used_wrap = !rx->pipe.used_wrap;
+        }
+        done++;
+    }
+
+    mxlk_pool_free_bulk(mxlk, &mxlk->rx_pool, spare + used, nspare - used);
+    mxlk_free_bd_list(mxlk, &mxlk->rx_pool, &dropped);
+
+    mxlk_write_tds(&rx->pipe, rx->stage, first, head);
+
+    if (rx->pipe.shadow != head) {
+        rx->pipe.shadow = head;
+        if (!rx->pipe.packed) {
+            mxlk_set_tdr_head(&rx->pipe, head);
+        }
+        wmb();
+        mxlk_send_doorbell(mxlk);
+    }
+
+    mutex_unlock(&rx->lock);
+
+    trace_mxlk_rx_end(queue, done, drops_status + drops_interface);
+
+    /* Counters are folded in once per run to keep them off the per bd path */
+    mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_mmio_reads, mmio_reads);
+    if (done) {
+        mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_rx_runs, 1);
+        mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_rx_received, done);
+        mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_rx_pkts, pkts);
+        mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_rx_bytes, bytes);
+    }
+    if (drops_status) {
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_rx_drops_status, drops_status);
+    }
+    if (drops_interface) {
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_rx_drops_interface,
+                       drops_interface);
+    }
+    if (refill_failed) {
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_rx_refill_failures, 1);
+    }
+
+    return done;
+}
+
+static int mxlk_tx_process(struct mxlk_queue *queue, int budget)
+{
+    int done = 0;
+    u16 status;
+    u32 head, tail, first, old, ndesc;
+    u64 completion;
+    bool down = false;
+    struct mxlk *mxlk = queue->mxlk;
+    struct mxlk_stream *tx = &queue->tx;
+    struct mxlk_buf_desc *bd;
+    struct mxlk_dma_desc *dd;
+    struct mxlk_bd_list reaped;
+    struct mxlk_interface *inf;
+    u64 bytes = 0, now;
+    int pkts = 0, posted = 0, mmio_reads = 0;
+
+    mxlk_bd_list_init(&reaped);
+    mutex_lock(&tx->lock);
+
+    /* Only the device owned head is read back, the tail is ours. Packed
+     * rings have no head, every posted descriptor is checked for return. */
+    ndesc = tx->pipe.ndesc;
+    old   = tx->pipe.old;
+    tail  = tx->pipe.shadow;
+    head  = tail;
+    if (!tx->pipe.packed) {
+        head = mxlk_get_tdr_head(&tx->pipe);
+        mmio_reads++;
+    }
+
+    /* Stop processing here in case MX device is down. */
+    if (INVALID(head)) {
+        mutex_unlock(&tx->lock);
+        mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_mmio_reads, mmio_reads);
+        return 0;
+    }
+
+    /* One timestamp serves both the reaped and the posted descriptors */
+    now = ktime_get_ns();
+    trace_mxlk_tx_start(queue, budget);
+
+    /* clean old entries first */
+    while (old != head && done < budget) {
+        dd = tx->ddr + old;
+        bd = dd->bd;
+
+        if (tx->pipe.packed) {
+            completion = mxlk_get_td_completion(&tx->pipe, old);
+            if (!tx->pipe.host) {
+                mmio_reads += MXLK_TD_COMPLETION_READS;
+            }
+            status = MXLK_TD_COMPLETION_STATUS(completion);
+            /* all ones once the device is down */
+            if (completion == ~0ULL) {
+                down = true;
+                break;
+            }
+            if (!mxlk_td_is_used(&tx->pipe, status)) {
+                break;
+            }
+            status &= MXLK_DESC_STATUS_CODE_MASK;
+        } else {
+            status = mxlk_get_ring_status(&tx->pipe, old);
+            if (!tx->pipe.host) {
+                mmio_reads++;
+            }
+        }
+        if (status != MXLK_DESC_STATUS_SUCCESS) {
+            mx_err("detected tx desc failure (%u)\n", status);
+        }
+        pkts++;
+        bytes += bd->length;
+        inf = mxlk->interfaces + bd->interface;
+        atomic_dec(&inf->tx_inflight);
+        mxlk_latency_record(inf->latency, MXLK_LAT_tx_queue,
+                            bd->stamp, bd->posted);
+        mxlk_latency_record(inf->latency, MXLK_LAT_tx_device, bd->posted, now);
+        mxlk_latency_record(inf->latency, MXLK_LAT_tx_total, bd->stamp, now);
+
+        if (bd->zc) {
+            mxlk_zc_bd_done(mxlk, bd,
+                            (status == MXLK_DESC_STATUS_SUCCESS) ? 0 : -EIO);
+        } else {
+            mxlk_sync_dma_for_cpu(mxlk, dd, dd->length, DMA_TO_DEVICE);
+            mxlk_bd_list_add(&reaped, bd);
+        }
+        dd->bd = NULL;
+        old = MXLK_CIRCULAR_INC(old, ndesc);
+        if (!old) {
+            tx->pipe.used_wrap = !tx->pipe.used_wrap;
+        }
+        done++;
+    }
+    tx->pipe.old = old;
+    mxlk_free_bd_list(mxlk, &mxlk->tx_pool, &reaped);
+    mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_mmio_reads, mmio_reads);
+    if (pkts) {
+        mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_tx_reap_runs, 1);
+        mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_tx_reaped, pkts);
+        mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_tx_pkts, pkts);
+        mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_tx_bytes, bytes);
+    }
+
+    /* add new entries, staged and written to the ring in one burst */
+    first = tail;
+    while (!down && (MXLK_CIRCULAR_INC(tail, ndesc) != old)) {
+        bd = mxlk_tx_dequeue(queue);
+        if (!bd) {
+            break;
+        }
+
+        dd = tx->ddr + tail;
+
+        dd->bd = bd;
+        bd->posted = now;
+        mxlk_sync_dma_for_device(mxlk, dd, DMA_TO_DEVICE);
+
+        status = MXLK_DESC_STATUS_ERROR;
+        if (tx->pipe.packed) {
+            status = mxlk_td_avail_status(&tx->pipe, status);
+        }
+        mxlk_stage_td(tx->stage + tail, dd->phys, dd->length,
+                      bd->interface | bd->flags, status);
+
+        tail = MXLK_CIRCULAR_INC(tail, ndesc);
+        if (!tail) {
+            tx->pipe.avail_wrap = !tx->pipe.avail_wrap;
+        }
+        posted++;
+    }
+
+    /* descriptors must land before the tail update that publishes them */
+    mxlk_write_tds(&tx->pipe, tx->stage, first, tail);
+
+    if (tx->pipe.shadow != tail) {
+        tx->pipe.shadow = tail;
+        if (!tx->pipe.packed) {
+            mxlk_set_tdr_tail(&tx->pipe, tail);
+        }
+        wmb();
+        mxlk_send_doorbell(mxlk);
+    }
+
+    mutex_unlock(&tx->lock);
+
+    trace_mxlk_tx_end(queue, done, posted);
+
+    if (done || posted) {
+        /* Wake up write wait queue in case someone is waiting for TX buffers
+         * or for room in a write queue */
+        wake_up(&mxlk->wr_waitq);
+    }
+
+    return done;
+}
+
+/*
+ * Picks the next bd to post on the TX ring of a queue. Only interfaces of the
+ * highest backlogged priority are served, in deficit round robin: each gets
+ * tx_weight fragments worth of bytes per round, so a bulk interface cannot
+ * hold the ring for long against a light one.
+ * Called with the queue TX lock held.
+ * NOTES:
+ *  1) groundwork for more interfaces: while MXLK_NUM_INTERFACES is 1 this
+ *     always serves interface 0, and its tx_weight/tx_priority files are not
+ *     created
+ */
+static struct mxlk_buf_desc *mxlk_tx_dequeue(struct mxlk_queue *queue)
+{
+    int index, id, prio = -1;
+    struct mxlk *mxlk = queue->mxlk;
+    struct mxlk_interface *inf;
+    struct mxlk_buf_desc *bd;
+
+    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
+        inf = mxlk->interfaces + index;
+        if (mxlk_spsc_peek(&queue->write[index]) &&
+            ((int) inf->tx_priority > prio)) {
+            prio = inf->tx_priority;
+        }
+    }
+    if (prio < 0) {
+        return NULL;
+    }
+
+    /* Each pass around adds at least one fragment of credit to all eligible
+     * interfaces, and no bd is larger than a fragment: two passes at most */
+    for (index = 0; index <= 2 * MXLK_NUM_INTERFACES; index++) {
+        id = queue->drr_next;
+        inf = mxlk->interfaces + id;
+        bd = mxlk_spsc_peek(&queue->write[id]);
+        if (!bd) {
+            /* idle interfaces do not bank credit */
+            queue->deficit[id] = 0;
+        } else if ((int) inf->tx_priority == prio) {
+            if (bd->length <= queue->deficit[id]) {
+                mxlk_spsc_pop(&queue->write[id]);
+                queue->deficit[id] -= bd->length;
+                return bd;
+            }
+        }
+
+        /* Move on to the next interface and give it this round's quantum */
+        queue->drr_next = (id + 1) % MXLK_NUM_INTERFACES;
+        id = queue->drr_next;
+        inf = mxlk->interfaces + id;
+        if (((int) inf->tx_priority == prio) &&
+            mxlk_spsc_peek(&queue->write[id])) {
+            queue->deficit[id] += max(inf->tx_weight, 1U) * mxlk->fragment_size;
+        }
+    }
+
+    return NULL;
+}
+
+static void mxlk_rx_event(struct mxlk_queue *queue)
+{
+    struct mxlk_pipe *pipe = &queue->rx.pipe;
+    bool restart = false;
+    int done;
+
+    mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_rx_event_runs, 1);
+
+    /* A packed pass takes at most a lap less one, go again for the rest */
+    do {
+        done = mxlk_rx_process(queue, INT_MAX, &restart, false);
+    } while (pipe->packed && !restart && (done == pipe->ndesc - 1));
+
+    if (unlikely(restart)) {
+        trace_mxlk_rx_restart(queue->mxlk, queue->id, 5);
+        msleep(5);
+        mxlk_start_rx(queue);
+    }
+}
+
+static void mxlk_rx_event_handler(struct work_struct *work)
+{
+    mxlk_rx_event(container_of(work, struct mxlk_queue, rx_event));
+}
+
+static void mxlk_rx_kwork_handler(struct kthread_work *work)
+{
+    mxlk_rx_event(container_of(work, struct mxlk_queue, rx_kwork));
+}
+
+static void mxlk_tx_event(struct mxlk_queue *queue)
+{
+    mxlk_queue_stats_add(queue->stats, MXLK_QSTAT_tx_event_runs, 1);
+
+    mxlk_tx_process(queue, INT_MAX);
+}
+
+static void mxlk_tx_event_handler(struct work_struct *work)
+{
+    mxlk_tx_event(container_of(work, struct mxlk_queue, tx_event));
+}
+
+static void mxlk_tx_kwork_handler(struct kthread_work *work)
+{
+    mxlk_tx_event(container_of(work, struct mxlk_queue, tx_kwork));
+}
+
+/* Called from the interrupt handlers, irqs come from the mxlk_events_init
+ * lookup */
+static void mxlk_poll_irq_disable(struct mxlk *mxlk)
+{
+    int vector;
+
+    if (mxlk->features & MXLK_TXRX_FEATURE_MULTI_MSI) {
+        set_bit(MXLK_POLL_SPLIT_IRQ, &mxlk->poll_state);
+        for (vector = MXLK_IRQ_VECTOR_RX; vector < mxlk->mx_dev.irq_vectors;
+             vector++) {
+            disable_irq_nosync(mxlk->irqs[vector]);
+        }
+    } else {
+        disable_irq_nosync(mxlk->irqs[MXLK_IRQ_VECTOR_STATUS]);
+    }
+}
+
+static void mxlk_poll_irq_enable(struct mxlk *mxlk)
+{
+    int vector;
+
+    /* MSIs raised while disabled are replayed by the irq core on enable */
+    if (test_and_clear_bit(MXLK_POLL_SPLIT_IRQ, &mxlk->poll_state)) {
+        for (vector = MXLK_IRQ_VECTOR_RX; vector < mxlk->mx_dev.irq_vectors;
+             vector++) {
+            enable_irq(mxlk->irqs[vector]);
+        }
+    } else {
+        enable_irq(mxlk->irqs[MXLK_IRQ_VECTOR_STATUS]);
+    }
+}
+
+static void mxlk_poll_queue(struct mxlk *mxlk)
+{
+    if (mxlk->service) {
+        kthread_queue_work(mxlk->service, &mxlk->poll_kwork);
+    } else {
+        queue_work(mxlk->wq, &mxlk->poll);
+    }
+}
+
+static void mxlk_poll_schedule(struct mxlk *mxlk)
+{
+    if (!test_and_set_bit(MXLK_POLL_SCHED, &mxlk->poll_state)) {
+        mxlk_poll_irq_disable(mxlk);
+        mxlk_poll_queue(mxlk);
+    }
+}
+
+static void mxlk_poll_stop(struct mxlk *mxlk)
+{
+    /* Leave no data irq masked behind a cancelled poll */
+    cancel_work_sync(&mxlk->poll);
+    kthread_cancel_work_sync(&mxlk->poll_kwork);
+    if (test_and_clear_bit(MXLK_POLL_SCHED, &mxlk->poll_state)) {
+        mxlk_poll_irq_enable(mxlk);
+    }
+}
+
+static void mxlk_poll(struct mxlk *mxlk)
+{
+    int budget = mxlk->poll_budget;
+    bool restart = false;
+    bool busy = false;
+    int index, rx_done, tx_done;
+
+    mxlk_stats_add(mxlk->stats, MXLK_STAT_polls, 1);
+
+    for (index = 0; index < mxlk->num_queues; index++) {
+        struct mxlk_queue *queue = mxlk->queues + index;
+
+        rx_done = mxlk_rx_process(queue, budget, &restart, false);
+        tx_done = mxlk_tx_process(queue, budget);
+        if ((rx_done >= budget) || (tx_done >= budget)) {
+            busy = true;
+        }
+    }
+
+    /* Rings still busy: stay masked and yield the worker before next run */
+    if (busy) {
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_poll_budget_exhausted, 1);
+        mxlk_poll_queue(mxlk);
+        return;
+    }
+
+    /* RX pool exhausted: give readers some time to return buffers */
+    if (unlikely(restart)) {
+        trace_mxlk_rx_restart(mxlk, -1, 5);
+        msleep(5);
+        mxlk_poll_queue(mxlk);
+        return;
+    }
+
+    /* Rings idle: re-arm interrupts */
+    clear_bit(MXLK_POLL_SCHED, &mxlk->poll_state);
+    mxlk_poll_irq_enable(mxlk);
+}
+
+static void mxlk_poll_handler(struct work_struct *work)
+{
+    mxlk_poll(container_of(work, struct mxlk, poll));
+}
+
+static void mxlk_poll_kwork_handler(struct kthread_work *work)
+{
+    mxlk_poll(container_of(work, struct mxlk, poll_kwork));
+}
+
+static void mxlk_status_event_handler(struct work_struct *work)
+{
+    int index;
+    int status;
+    struct mxlk *mxlk = container_of(work, struct mxlk, status_event);
+
+    status = mxlk_get_device_status(mxlk);
+    if (status != MXLK_STATUS_RUN) {
+        mx_err("device status changed to %d\n", status);
+    }
+
+    /* Let sleepers re-evaluate the link state */
+    wake_up(&mxlk->wr_waitq);
+    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
+        wake_up(&mxlk->interfaces[index].rd_waitq);
+    }
+}
+
+static void mxlk_start_tx(struct mxlk_queue *queue)
+{
+    if (queue->mxlk->service) {
+        kthread_queue_work(queue->mxlk->service, &queue->tx_kwork);
+    } else {
+        queue_work(queue->mxlk->wq, &queue->tx_event);
+    }
+}
+
+static void mxlk_start_rx(struct mxlk_queue *queue)
+{
+    if (queue->mxlk->service) {
+        kthread_queue_work(queue->mxlk->service, &queue->rx_kwork);
+    } else {
+        queue_work(queue->mxlk->wq, &queue->rx_event);
+    }
+}
+
+/*
+ * Ring work of a device goes to its own thread instead of the shared
+ * workqueue, so that it can be pinned and given a realtime priority. CPUs and
+ * priority set through sysfs outlive the thread and are applied again when a
+ * reset creates it anew.
+ */
+static int mxlk_service_init(struct mxlk *mxlk)
+{
+    struct kthread_worker *service;
+    int error;
+
+    if (!service_threads) {
+        return 0;
+    }
+
+    service = kthread_create_worker(0, "%s", mxlk->name);
+    if (IS_ERR(service)) {
+        mx_err("failed to create service thread (%ld)\n", PTR_ERR(service));
+        return PTR_ERR(service);
+    }
+    mxlk->service = service;
+
+    if (!cpumask_empty(&mxlk->service_cpus)) {
+        error = set_cpus_allowed_ptr(service->task, &mxlk->service_cpus);
+        if (error) {
+            mx_err("failed to restore service thread cpus (%d)\n", error);
+        }
+    }
+    if (mxlk->service_priority) {
+        error = mxlk_service_set_priority(mxlk, mxlk->service_priority);
+        if (error) {
+            mx_err("failed to restore service thread priority (%d)\n", error);
+            mxlk->service_priority = 0;
+        }
+    }
+
+    return 0;
+}
+
+static void mxlk_service_cleanup(struct mxlk *mxlk)
+{
+    if (mxlk->service) {
+        kthread_destroy_worker(mxlk->service);
+        mxlk->service = NULL;
+    }
+}
+
+/*
+ * Kernels from 5.9 on no longer let modules pick an exact SCHED_FIFO priority,
+ * so only 0 (normal) and 1 (lowest SCHED_FIFO) are accepted there and other
+ * priorities are left to chrt on the thread
+ */
+static int mxlk_service_set_priority(struct mxlk *mxlk, int priority)
+{
+    struct task_struct *task = mxlk->service->task;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,9,0)
+    if (!priority) {
+        sched_set_normal(task, 0);
+    } else if (priority == 1) {
+        sched_set_fifo_low(task);
+    } else {
+        return -EINVAL;
+    }
+#else
+    struct sched_param param = { .sched_priority = priority };
+    int error;
+
+    error = sched_setscheduler_nocheck(task,
+                                       priority ? SCHED_FIFO : SCHED_NORMAL,
+                                       &param);
+    if (error) {
+        return error;
+    }
+#endif
+
+    WRITE_ONCE(mxlk->service_priority, priority);
+
+    return 0;
+}
+
+static void mxlk_start_all(struct mxlk *mxlk)
+{
+    int index;
+
+    for (index = 0; index < mxlk->num_queues; index++) {
+        mxlk_start_tx(mxlk->queues + index);
+        mxlk_start_rx(mxlk->queues + index);
+    }
+}
+
+static void mxlk_send_doorbell(struct mxlk *mxlk)
+{
+    queue_work(mxlk->wq, &mxlk->send_doorbell);
+}
+
+static void mxlk_ring_doorbell(struct mxlk *mxlk)
+{
+    u32 value  = MXLK_DOORBELL_DATA;
+    int offset = MXLK_DOORBELL_ADDR;
+
+    mxlk_stats_add(mxlk->stats, MXLK_STAT_doorbells, 1);
+    trace_mxlk_doorbell(mxlk);
+    pci_write_config_dword(mxlk->pci, offset, value);
+}
+
+int mxlk_core_init(struct mxlk *mxlk, struct pci_dev *pdev,
+                   struct workqueue_struct *wq)
+{
+    int error;
+
+    mxlk->wq = wq;
+    mxlk->pci = pdev;
+    mxlk->poll_mode = poll_mode;
+    mxlk->poll_budget = (poll_budget > 0) ? poll_budget : 64;
+    mxlk->zc_threshold = (zc_threshold > 0) ? zc_threshold : 0;
+    mxlk->queue_select = queue_select;
+
+    mxlk->unit = atomic_fetch_inc(&units_found);
+    if (mxlk->unit < MXLK_MAX_DEVICES) {
+        scnprintf(mxlk->name, MXLK_MAX_NAME_LEN, MXLK_DRIVER_NAME"%d",
+                  mxlk->unit);
+    } else {
+        return -EPERM;
+    }
+
+    error = mx_pci_init(&mxlk->mx_dev, pdev, mxlk, MXLK_DRIVER_NAME, &mxlk->mmio);
+    if (error) {
+        return error;
+    }
+
+    mutex_init(&mxlk->stats_lock);
+    error = mxlk_stats_init(mxlk);
+    if (error) {
+        goto error_stats;
+    }
+
+    error = mxlk_latency_init(mxlk);
+    if (error) {
+        goto error_latency;
+    }
+
+    error = mxlk_events_init(mxlk);
+    if (error) {
+        goto error_events;
+    }
+
+    mx_boot_init(&mxlk->mx_dev);
+
+    /* Initialize character devices immediately: We need them to be alive at all
+     * time in order to be able to handle reset and boot operations. */
+    error = mxlk_all_chrdev_init(mxlk);
+    if (error) {
+        goto error_chrdev;
+    }
+
+    /* If the MX device is in proper application mode, start communications.
+     * If not, then we expect the user to reset the MX device and load a proper
+     * MX application before we can start operations. In this case,
+     * mxlk_comms_init() will be called at the end of the boot process. */
+    if (mx_get_opmode(&mxlk->mx_dev) == MX_OPMODE_APP_VPULINK) {
+        error = mxlk_comms_init(mxlk);
+        if (error) {
+            goto error_comms;
+        }
+    }
+
+    /* Save PCIe context now so that we have a base for restoring the link if
+     * the device ever resets itself. */
+    mx_pci_dev_ctx_save(&mxlk->mx_dev);
+
+    return 0;
+
+error_comms:
+    mxlk_all_chrdev_cleanup(mxlk);
+
+error_chrdev:
+    mxlk_events_cleanup(mxlk);
+
+error_events:
+    mxlk_latency_cleanup(mxlk);
+
+error_latency:
+    mxlk_stats_cleanup(mxlk);
+
+error_stats:
+    mx_pci_cleanup(&mxlk->mx_dev);
+    mx_err("core failed to init\n");
+
+    return error;
+}
+
+void mxlk_core_cleanup(struct mxlk *mxlk)
+{
+    if (mx_get_opmode(&mxlk->mx_dev) == MX_OPMODE_APP_VPULINK) {
+        mxlk_comms_cleanup(mxlk);
+    }
+    mxlk_all_chrdev_cleanup(mxlk);
+    mx_boot_cleanup(&mxlk->mx_dev);
+    mxlk_events_cleanup(mxlk);
+    mxlk_latency_cleanup(mxlk);
+    mxlk_stats_cleanup(mxlk);
+    mx_pci_cleanup(&mxlk->mx_dev);
+}
+
+static int mxlk_comms_init(struct mxlk *mxlk)
+{
+    int error;
+    int status;
+
+    status = mxlk_get_device_status(mxlk);
+    if (status != MXLK_STATUS_RUN) {
+        mx_err("device status not RUNNING (%d)\n", status);
+        error = -EIO;
+        goto error_device_status;
+    }
+
+    error = mxlk_version_check(mxlk);
+    if (error) {
+        goto error_version;
+    }
+
+    mxlk_discover_stats(mxlk);
+
+    /* Extended features first: they decide how many queues to set up */
+    mxlk_discover_txrx_ext(mxlk);
+    mxlk_discover_txrx_host(mxlk);
+
+    error = mxlk_discover_txrx(mxlk);
+    if (error) {
+        goto error_stream;
+    }
+
+    error = mxlk_interfaces_init(mxlk);
+    if (error) {
+        goto error_interfaces;
+    }
+
+    mxlk_set_host_status(mxlk, MXLK_STATUS_RUN);
+
+    error = sysfs_create_group(&MXLK_TO_DEV(mxlk)->kobj, &mxlk_attr_group);
+    if (error) {
+        mx_err("failed to create sysfs attributes (%d)\n", error);
+    }
+
+    mxlk_debug_reset(mxlk);
+
+    mxlk_ring_doorbell(mxlk);
+
+    return 0;
+
+error_interfaces :
+    mxlk_txrx_cleanup(mxlk);
+
+error_stream :
+error_version :
+error_device_status :
+    mx_err("comms failed to init\n");
+
+    return error;
+}
+
+static void mxlk_comms_cleanup(struct mxlk *mxlk)
+{
+    int index;
+
+    mxlk_set_host_status(mxlk, MXLK_STATUS_UNINIT);
+    /* Blocked readers and writers must see the link down and let go of the
+     * interface locks before anything they use is freed */
+    wake_up_all(&mxlk->wr_waitq);
+    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
+        wake_up_all(&mxlk->interfaces[index].rd_waitq);
+    }
+    mdelay(10);
+
+    /* Back to legacy signaling until features are negotiated again */
+    mxlk_poll_stop(mxlk);
+    mxlk->features = 0;
+    mxlk->num_queues = 0;
+    WRITE_ONCE(mxlk->cap_stats, NULL);
+
+    sysfs_remove_group(&MXLK_TO_DEV(mxlk)->kobj, &mxlk_attr_group);
+    mxlk_interfaces_cleanup(mxlk);
+    mxlk_txrx_cleanup(mxlk);
+}
+
+int mxlk_core_open(struct mxlk_interface *inf)
+{
+    if (inf->opened) {
+        return -EACCES;
+    }
+
+    inf->opened = 1;
+
+    return 0;
+}
+
+int mxlk_core_close(struct mxlk_interface *inf)
+{
+    if (inf->opened) {
+        inf->opened = 0;
+    }
+    inf->fd_busy_poll = -1;
+    inf->rcvtimeo = 0;
+    inf->sndtimeo = 0;
+    inf->rcvlowat = 0;
+    inf->sndlowat = 0;
+    inf->datagram = false;
+
+    /* Nothing may stay behind once the application is gone */
+    if (READ_ONCE(inf->coalesce)) {
+        mxlk_core_set_coalesce(inf, 0);
+    }
+
+    return 0;
+}
+
+void mxlk_core_set_busy_poll(struct mxlk_interface *inf, unsigned int usecs)
+{
+    inf->fd_busy_poll = min_t(unsigned int, usecs, INT_MAX);
+}
+
+void mxlk_core_set_timeout(struct mxlk_interface *inf, bool write,
+                           unsigned int msecs)
+{
+    if (write) {
+        WRITE_ONCE(inf->sndtimeo, msecs);
+    } else {
+        WRITE_ONCE(inf->rcvtimeo, msecs);
+    }
+}
+
+void mxlk_core_set_lowat(struct mxlk_interface *inf, bool write,
+                         unsigned int bytes)
+{
+    if (write) {
+        WRITE_ONCE(inf->sndlowat, bytes);
+        /* a lower threshold may already be met */
+        wake_up(&inf->mxlk->wr_waitq);
+    } else {
+        WRITE_ONCE(inf->rcvlowat, bytes);
+        wake_up(&inf->rd_waitq);
+    }
+}
+
+int mxlk_core_set_datagram(struct mxlk_interface *inf, bool enable)
+{
+    int error = 0;
+    struct mxlk *mxlk = inf->mxlk;
+
+    if (enable && (mxlk->status == MXLK_STATUS_RUN) &&
+        !(mxlk->features & MXLK_TXRX_FEATURE_MSG_FLAGS)) {
+        return -EOPNOTSUPP;
+    }
+
+    mutex_lock(&inf->rlock);
+    mutex_lock(&inf->wlock);
+    /* Whatever arrives from now on is whole records, but a record partly
+     * read in stream mode cannot be returned as a message */
+    if ((enable != inf->datagram) && atomic_read(&inf->read_msgs)) {
+        error = -EBUSY;
+    } else {
+        /* messages are never coalesced */
+        mxlk_flush_pending(inf);
+        WRITE_ONCE(inf->datagram, enable);
+    }
+    mutex_unlock(&inf->wlock);
+    mutex_unlock(&inf->rlock);
+
+    return error;
+}
+
+void mxlk_core_set_coalesce(struct mxlk_interface *inf, unsigned int usecs)
+{
+    mutex_lock(&inf->wlock);
+    WRITE_ONCE(inf->coalesce, usecs);
+    if (!usecs) {
+        mxlk_flush_pending(inf);
+    }
+    mutex_unlock(&inf->wlock);
+}
+
+void mxlk_core_flush(struct mxlk_interface *inf)
+{
+    mutex_lock(&inf->wlock);
+    if (inf->tx_pending) {
+        mxlk_stats_add(inf->mxlk->stats, MXLK_STAT_tx_flushes, 1);
+        mxlk_flush_pending(inf);
+    }
+    mutex_unlock(&inf->wlock);
+}
+
+static long mxlk_timeout_jiffies(unsigned int msecs)
+{
+    return msecs ? max_t(long, msecs_to_jiffies(msecs), 1) :
+                   MAX_SCHEDULE_TIMEOUT;
+}
+
+/* Bytes a read of length bytes waits for */
+static unsigned int mxlk_read_want(struct mxlk_interface *inf, size_t length)
+{
+    return min_t(size_t, max(READ_ONCE(inf->rcvlowat), 1U), length);
+}
+
+/* Enough RX data queued for a read of length bytes to return */
+static bool mxlk_read_ready(struct mxlk_interface *inf, size_t length)
+{
+    if (READ_ONCE(inf->datagram)) {
+        return (atomic_read(&inf->read_msgs) > 0);
+    }
+
+    return (atomic_read(&inf->read_bytes) >= (int) mxlk_read_want(inf, length));
+}
+
+/* Anything at all queued for a read */
+static bool mxlk_read_any(struct mxlk_interface *inf)
+{
+    if (READ_ONCE(inf->datagram)) {
+        return (atomic_read(&inf->read_msgs) > 0);
+    }
+
+    return (atomic_read(&inf->read_bytes) > 0);
+}
+
+/* Enough free TX buffers for a write of length bytes to make progress */
+static bool mxlk_write_ready(struct mxlk_interface *inf, size_t length)
+{
+    struct mxlk *mxlk = inf->mxlk;
+    size_t lowat = max_t(size_t, max(READ_ONCE(inf->sndlowat), 1U), length);
+
+    if (!mxlk->fragment_size) {
+        return false;
+    }
+
+    return (mxlk_pool_count(&mxlk->tx_pool) >=
+            DIV_ROUND_UP(lowat, mxlk->fragment_size));
+}
+
+ssize_t mxlk_core_read(struct mxlk_interface *inf, struct iov_iter *to,
+                       bool nowait)
+{
+    struct mxlk *mxlk = inf->mxlk;
+    size_t length = iov_iter_count(to);
+    size_t remaining = length;
+    struct mxlk_buf_desc *bd;
+    struct mxlk_bd_list consumed;
+    unsigned int busy_poll;
+    ssize_t read;
+    long timeout;
+    int pkts = 0;
+    u64 now;
+
+    busy_poll = (inf->fd_busy_poll >= 0) ? inf->fd_busy_poll : inf->busy_poll;
+
+    if (nowait) {
+        if (!mutex_trylock(&inf->rlock)) {
+            return -EAGAIN;
+        }
+    } else {
+        mutex_lock(&inf->rlock);
+    }
+    {
+        if (busy_poll && (mxlk->status == MXLK_STATUS_RUN) &&
+            !mxlk_core_read_data_available(inf)) {
+            mxlk_busy_poll(inf, busy_poll);
+        }
+
+        /* Sleep until enough is queued, a short read is fine on timeout */
+        if (!nowait && length && !mxlk_read_ready(inf, length) &&
+            (mxlk->status == MXLK_STATUS_RUN)) {
+            /* Let RX processing wake us for less than rcvlowat if asked so */
+            WRITE_ONCE(inf->rcvwant, mxlk_read_want(inf, length));
+            timeout = wait_event_interruptible_timeout(inf->rd_waitq,
+                            mxlk_read_ready(inf, length) ||
+                            (mxlk->status != MXLK_STATUS_RUN),
+                            mxlk_timeout_jiffies(READ_ONCE(inf->rcvtimeo)));
+            WRITE_ONCE(inf->rcvwant, 0);
+            if (timeout < 0) {
+                mutex_unlock(&inf->rlock);
+                return timeout;
+            }
+            if (!timeout && !mxlk_read_any(inf)) {
+                mutex_unlock(&inf->rlock);
+                return -EAGAIN;
+            }
+        }
+
+        if (inf->datagram) {
+            read = mxlk_read_msg(inf, to);
+            mutex_unlock(&inf->rlock);
+            /* a blocking read only finds nothing once the link is down */
+            return (read == -EAGAIN && !nowait) ? 0 : read;
+        }
+
+        mxlk_bd_list_init(&consumed);
+        now = ktime_get_ns();
+        bd = (inf->partial_read) ? inf->partial_read : mxlk_ring_pop(&inf->read);
+        while (remaining && bd) {
+            size_t bcopy, copied;
+
+            bcopy = min(remaining, bd->length);
+            copied = copy_to_iter(bd->data, bcopy, to);
+
+            remaining -= copied;
+            bd->data += copied;
+            bd->length -= copied;
+
+            if (copied != bcopy) {
+                mx_err("failed to copy to user %zu/%zu\n", copied, bcopy);
+                break;
+            }
+
+            if (bd->length == 0) {
+                if (!bd->flags || (bd->flags & MXLK_DESC_FLAG_EOM)) {
+                    atomic_dec(&inf->read_msgs);
+                }
+                pkts++;
+                mxlk_latency_record(inf->latency, MXLK_LAT_rx_read,
+                                    bd->stamp, now);
+                mxlk_bd_list_add(&consumed, bd);
+                /* Hand buffers back in batches, not only at the end */
+                if (consumed.count == MXLK_BD_CACHE_SIZE) {
+                    mxlk_free_bd_list(mxlk, &mxlk->rx_pool, &consumed);
+                }
+                bd = mxlk_ring_pop(&inf->read);
+            }
+        }
+        mxlk_free_bd_list(mxlk, &mxlk->rx_pool, &consumed);
+        atomic_sub(length - remaining, &inf->read_bytes);
+
+        /* save for next time */
+        inf->partial_read = bd;
+    }
+    mutex_unlock(&inf->rlock);
+
+    /* Counters are folded in once per call, not per fragment */
+    if (pkts) {
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_rx_usr_pkts, pkts);
+    }
+    if (length != remaining) {
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_rx_usr_bytes, length - remaining);
+    }
+
+    /* Let non-blocking callers (io_uring) wait for POLLIN and retry */
+    if (nowait && length && remaining == length) {
+        return -EAGAIN;
+    }
+
+    return (length - remaining);
+}
+
+ssize_t mxlk_core_write(struct mxlk_interface *inf, struct iov_iter *from,
+                        bool nowait)
+{
+    size_t length = iov_iter_count(from);
+    size_t remaining = length;
+    struct mxlk *mxlk = inf->mxlk;
+    struct mxlk_buf_desc *bd;
+    u64 stamp = ktime_get_ns();
+    ssize_t written;
+    long timeout;
+    int error = 0;
+    int pkts = 0;
+    size_t bytes = 0;
+
+    if (nowait) {
+        if (!mutex_trylock(&inf->wlock)) {
+            return -EAGAIN;
+        }
+    } else {
+        mutex_lock(&inf->wlock);
+    }
+
+    if (inf->datagram) {
+        written = mxlk_write_msg(inf, from, nowait, stamp);
+        mutex_unlock(&inf->wlock);
+        return written;
+    }
+
+    /* Zero-copy writes wait for the device, never take them when nowait */
+    while (!nowait && mxlk->zc_threshold &&
+           remaining >= mxlk->zc_threshold) {
+        /* coalesced bytes go out first, data must stay in order */
+        mxlk_flush_pending(inf);
+        written = mxlk_zc_write(inf, from, stamp);
+        if (written == -EAGAIN) {
+            /* could not pin or map the user buffer, copy it instead */
+            mxlk_stats_add(mxlk->stats, MXLK_STAT_zc_fallbacks, 1);
+            break;
+        }
+        if (written < 0) {
+            mutex_unlock(&inf->wlock);
+            return (remaining == length) ? written : (length - remaining);
+        }
+        remaining -= written;
+    }
 
-    mxlk->stats.tx_event_runs++;
+    /* Top up the fragment left partly filled by earlier small writes */
+    bd = inf->tx_pending;
+    if (bd && remaining) {
+        size_t bcopy, copied;
 
-    ndesc = tx->pipe.ndesc;
-    old   = tx->pipe.old;
-    tail  = mxlk_get_tdr_tail(&tx->pipe);
-    head  = mxlk_get_tdr_head(&tx->pipe);
+        bcopy = min(remaining, bd->true_len - bd->length);
+        copied = copy_from_iter(bd->data + bd->length, bcopy, from);
 
-    /* Stop processing here in case MX device is down. */
-    if (INVALID(head) || INVALID(tail)) {
-        return;
+        remaining -= copied;
+        bd->length += copied;
+        bytes += copied;
+
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_tx_coalesced, 1);
+        if (copied != bcopy) {
+            mx_err("failed to copy from user %zu/%zu\n", copied, bcopy);
+            error = -EFAULT;
+        }
+        if (bd->length == bd->true_len) {
+            mxlk_flush_pending(inf);
+        }
     }
 
-    /* clean old entries first */
-    while (old != head) {
-        dd = tx->ddr + old;
-        td = tx->pipe.tdr + old;
-        bd = dd->bd;
+    timeout = mxlk_timeout_jiffies(READ_ONCE(inf->sndtimeo));
+    while (remaining && !error) {
+        int nbds = 0;
+        bool fault = false;
+        struct mxlk_bd_list list, unused;
+        struct mxlk_buf_desc *last = NULL, *prev = NULL;
 
-        status = mxlk_get_td_status(td);
-        if (status != MXLK_DESC_STATUS_SUCCESS) {
-            mx_err("detected tx desc failure (%u)\n", status);
+        if (mxlk->status != MXLK_STATUS_RUN) {
+            break;
         }
-        mxlk->stats.tx_krn.pkts++;
-        mxlk->stats.tx_krn.bytes += bd->length;
 
-        mxlk_unmap_dma(mxlk, dd, DMA_TO_DEVICE);
-        mxlk_free_tx_bd(mxlk, dd->bd);
-        dd->bd = NULL;
-        old = MXLK_CIRCULAR_INC(old, ndesc);
-        buffer_freed = true;
-    }
-    tx->pipe.old = old;
+        mxlk_bd_list_init(&list);
+        mxlk_alloc_tx_bds(mxlk, &list,
+                          DIV_ROUND_UP(remaining, mxlk->fragment_size));
 
-    /* add new entries */
-    while (MXLK_CIRCULAR_INC(tail, ndesc) != head) {
-        bd = mxlk_list_get(&mxlk->write);
-        if (!bd) {
-            break;
+        /* Out of TX buffers: sleep until the reaper frees enough of them */
+        if (!list.count) {
+            if (nowait) {
+                break;
+            }
+            timeout = wait_event_interruptible_timeout(mxlk->wr_waitq,
+                            mxlk_write_ready(inf, 0) ||
+                            (mxlk->status != MXLK_STATUS_RUN), timeout);
+            if (timeout <= 0) {
+                error = timeout ? timeout : -EAGAIN;
+            }
+            continue;
         }
 
-        dd = tx->ddr + tail;
-        td = tx->pipe.tdr + tail;
+        for (bd = list.head; remaining && bd; bd = bd->next) {
+            size_t bcopy, copied;
 
-        dd->bd = bd;
-        if (mxlk_map_dma(mxlk, dd, DMA_TO_DEVICE)) {
-            mx_err("dma mapping error bd addr %px, size %zu\n",
-                   bd->data, bd->length);
-            break;
+            bcopy = min(bd->length, remaining);
+            copied = copy_from_iter(bd->data, bcopy, from);
+
+            remaining -= copied;
+            bd->length = copied;
+            bd->interface = inf->id;
+            bd->flags = 0;
+
+            pkts++;
+            bytes += copied;
+            nbds++;
+            prev = last;
+            last = bd;
+
+            if (copied != bcopy) {
+                mx_err("failed to copy from user %zu/%zu\n", copied, bcopy);
+                fault = true;
+                break;
+            }
         }
 
-        mxlk_set_td_address(td, dd->phys);
-        mxlk_set_td_length(td, dd->length);
-        mxlk_set_td_interface(td, bd->interface);
-        mxlk_set_td_status(td, MXLK_DESC_STATUS_ERROR);
+        /* Give back what a failed copy left unused */
+        if (last && last->next) {
+            unused.head = last->next;
+            unused.tail = list.tail;
+            unused.count = list.count - nbds;
+            last->next = NULL;
+            mxlk_free_bd_list(mxlk, &mxlk->tx_pool, &unused);
+        }
 
-        tail = MXLK_CIRCULAR_INC(tail, ndesc);
-    }
+        /* A short tail fragment waits for the next writes to fill it */
+        if (!fault && READ_ONCE(inf->coalesce) && last &&
+            (last->length < last->true_len)) {
+            last->stamp = stamp;
+            inf->tx_pending = last;
+            queue_delayed_work(mxlk->wq, &inf->flush,
+                               usecs_to_jiffies(READ_ONCE(inf->coalesce)));
+            if (prev) {
+                prev->next = NULL;
+            }
+            nbds--;
+        }
 
-    if (mxlk_get_tdr_tail(&tx->pipe) != tail) {
-        mxlk_set_tdr_tail(&tx->pipe, tail);
-        wmb();
-        mxlk_send_doorbell(mxlk);
+        if (nbds) {
+            mxlk_queue_write(inf, list.head, nbds, stamp);
+        }
+        if (fault) {
+            error = -EFAULT;
+        }
     }
+    mutex_unlock(&inf->wlock);
 
-    if (buffer_freed == true) {
-        /* Wake up write wait queue in case someone is waiting for TX buffers */
-        wake_up(&mxlk->wr_waitq);
+    /* Counters are folded in once per call, not per fragment */
+    if (pkts) {
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_tx_usr_pkts, pkts);
+    }
+    if (bytes) {
+        mxlk_stats_add(mxlk->stats, MXLK_STAT_tx_usr_bytes, bytes);
     }
-}
-
-static void mxlk_start_tx(struct mxlk *mxlk)
-{
-    queue_work(mxlk->wq, &mxlk->tx_event);
-}
 
-static void mxlk_start_rx(struct mxlk *mxlk)
-{
-    queue_work(mxlk->wq, &mxlk->rx_event);
-}
+    if (remaining != length) {
+        return (length - remaining);
+    }
+    if (error) {
+        return error;
+    }
 
-static void mxlk_send_doorbell(struct mxlk *mxlk)
-{
-    queue_work(mxlk->wq, &mxlk->send_doorbell);
+    /* Let non-blocking callers (io_uring) wait for POLLOUT and retry */
+    return (nowait && length) ? -EAGAIN : 0;
 }
 
-static void mxlk_ring_doorbell(struct mxlk *mxlk)
+/*
+ * Returns the record at the head of the read queue as one message, or fails
+ * with -EMSGSIZE, leaving it queued, if it does not fit. A copy fault drops
+ * the message. Called with the read lock held.
+ */
+static ssize_t mxlk_read_msg(struct mxlk_interface *inf, struct iov_iter *to)
 {
-    u32 value  = MXLK_DOORBELL_DATA;
-    int offset = MXLK_DOORBELL_ADDR;
+    struct mxlk *mxlk = inf->mxlk;
+    struct mxlk_buf_desc *bd;
+    struct mxlk_bd_list consumed;
+    size_t msg_len, copied;
+    int error = 0, pkts = 0;
+    bool last;
+    u64 now;
+
+    if (!atomic_read(&inf->read_msgs)) {
+        return -EAGAIN;
+    }
+    /* pairs with the full barrier between msg_len and read_msgs updates */
+    smp_rmb();
 
-    mxlk->stats.doorbells++;
-    pci_write_config_dword(mxlk->pci, offset, value);
-}
+    bd = (inf->partial_read) ? inf->partial_read : mxlk_ring_pop(&inf->read);
+    if (!bd) {
+        return -EAGAIN;
+    }
 
-int mxlk_core_init(struct mxlk *mxlk, struct pci_dev *pdev,
-                   struct workqueue_struct *wq)
-{
-    int error;
+    msg_len = bd->msg_len;
+    if (msg_len > iov_iter_count(to)) {
+        inf->partial_read = bd;
+        return -EMSGSIZE;
+    }
+    inf->partial_read = NULL;
 
-    mxlk->wq = wq;
-    mxlk->pci = pdev;
+    mxlk_bd_list_init(&consumed);
+    now = ktime_get_ns();
+    do {
+        if (!error) {
+            copied = copy_to_iter(bd->data, bd->length, to);
+            if (copied != bd->length) {
+                mx_err("failed to copy to user %zu/%zu\n", copied, bd->length);
+                error = -EFAULT;
+            }
+        }
+        pkts++;
+        mxlk_latency_record(inf->latency, MXLK_LAT_rx_read, bd->stamp, now);
 
-    mxlk->unit = atomic_fetch_inc(&units_found);
-    if (mxlk->unit < MXLK_MAX_DEVICES) {
-        scnprintf(mxlk->name, MXLK_MAX_NAME_LEN, MXLK_DRIVER_NAME"%d",
-                  mxlk->unit);
-    } else {
-        return -EPERM;
-    }
+        last = !bd->flags || (bd->flags & MXLK_DESC_FLAG_EOM);
+        mxlk_bd_list_add(&consumed, bd);
+        if (consumed.count == MXLK_BD_CACHE_SIZE) {
+            mxlk_free_bd_list(mxlk, &mxlk->rx_pool, &consumed);
+        }
+    } while (!last && (bd = mxlk_ring_pop(&inf->read)));
+    mxlk_free_bd_list(mxlk, &mxlk->rx_pool, &consumed);
 
-    error = mx_pci_init(&mxlk->mx_dev, pdev, mxlk, MXLK_DRIVER_NAME, &mxlk->mmio);
+    atomic_dec(&inf->read_msgs);
+    atomic_sub(msg_len, &inf->read_bytes);
+    mxlk_stats_add(mxlk->stats, MXLK_STAT_rx_usr_pkts, pkts);
     if (error) {
         return error;
     }
+    mxlk_stats_add(mxlk->stats, MXLK_STAT_rx_usr_bytes, msg_len);
 
-    error = mxlk_events_init(mxlk);
-    if (error) {
-        goto error_events;
-    }
+    return msg_len;
+}
 
-    mx_boot_init(&mxlk->mx_dev);
+/*
+ * Sends a whole write as one message: the TX buffers for all of it are taken
+ * at once, so a message is either queued complete or not at all. Called with
+ * the write lock held.
+ */
+static ssize_t mxlk_write_msg(struct mxlk_interface *inf,
+                              struct iov_iter *from, bool nowait, u64 stamp)
+{
+    struct mxlk *mxlk = inf->mxlk;
+    size_t length = iov_iter_count(from);
+    size_t remaining = length;
+    size_t bcopy, copied;
+    struct mxlk_bd_list list;
+    struct mxlk_buf_desc *bd;
+    long timeout;
+    int nbds;
 
-    /* Initialize character devices immediately: We need them to be alive at all
-     * time in order to be able to handle reset and boot operations. */
-    error = mxlk_all_chrdev_init(mxlk);
-    if (error) {
-        goto error_chrdev;
+    if (mxlk->status != MXLK_STATUS_RUN) {
+        return 0;
+    }
+    if (!(mxlk->features & MXLK_TXRX_FEATURE_MSG_FLAGS)) {
+        return -EOPNOTSUPP;
+    }
+    if (!length) {
+        return 0;
     }
 
-    /* If the MX device is in proper application mode, start communications.
-     * If not, then we expect the user to reset the MX device and load a proper
-     * MX application before we can start operations. In this case,
-     * mxlk_comms_init() will be called at the end of the boot process. */
-    if (mx_get_opmode(&mxlk->mx_dev) == MX_OPMODE_APP_VPULINK) {
-        error = mxlk_comms_init(mxlk);
-        if (error) {
-            goto error_comms;
-        }
+    /* The receiving end takes no more than it would let through itself */
+    nbds = DIV_ROUND_UP(length, mxlk->fragment_size);
+    if ((nbds > mxlk->msg_max_bds) || (nbds > READ_ONCE(mxlk->tx_pool.max))) {
+        return -EMSGSIZE;
     }
 
-    /* Save PCIe context now so that we have a base for restoring the link if
-     * the device ever resets itself. */
-    mx_pci_dev_ctx_save(&mxlk->mx_dev);
+    timeout = mxlk_timeout_jiffies(READ_ONCE(inf->sndtimeo));
+    for (;;) {
+        mxlk_bd_list_init(&list);
+        mxlk_alloc_tx_bds(mxlk, &list, nbds);
+        if (list.count == nbds) {
+            break;
+        }
+        mxlk_free_bd_list(mxlk, &mxlk->tx_pool, &list);
 
-    return 0;
+        if (nowait) {
+            return -EAGAIN;
+        }
+        timeout = wait_event_interruptible_timeout(mxlk->wr_waitq,
+                        mxlk_write_ready(inf, length) ||
+                        (mxlk->status != MXLK_STATUS_RUN), timeout);
+        if (timeout <= 0) {
+            return timeout ? timeout : -EAGAIN;
+        }
+        if (mxlk->status != MXLK_STATUS_RUN) {
+            return 0;
+        }
+    }
 
-error_comms:
-    mxlk_all_chrdev_cleanup(mxlk);
+    for (bd = list.head; bd; bd = bd->next) {
+        bcopy = min(bd->length, remaining);
+        copied = copy_from_iter(bd->data, bcopy, from);
+        if (copied != bcopy) {
+            mx_err("failed to copy from user %zu/%zu\n", copied, bcopy);
+            mxlk_free_bd_list(mxlk, &mxlk->tx_pool, &list);
+            return -EFAULT;
+        }
 
-error_chrdev:
-    mxlk_events_cleanup(mxlk);
+        remaining -= copied;
+        bd->length = copied;
+        bd->interface = inf->id;
+        bd->flags = 0;
+    }
+    list.head->flags |= MXLK_DESC_FLAG_SOM;
+    list.tail->flags |= MXLK_DESC_FLAG_EOM;
 
-error_events:
-    mx_pci_cleanup(&mxlk->mx_dev);
-    mx_err("core failed to init\n");
+    mxlk_stats_add(mxlk->stats, MXLK_STAT_tx_usr_pkts, nbds);
+    mxlk_stats_add(mxlk->stats, MXLK_STAT_tx_usr_bytes, length);
+    mxlk_queue_write(inf, list.head, nbds, stamp);
 
-    return error;
+    return length;
 }
 
-void mxlk_core_cleanup(struct mxlk *mxlk)
+static void mxlk_zc_release(struct mxlk *mxlk, struct mxlk_zc *zc)
 {
-    if (mx_get_opmode(&mxlk->mx_dev) == MX_OPMODE_APP_VPULINK) {
-        mxlk_comms_cleanup(mxlk);
+    if (zc->nents) {
+        dma_unmap_sg(MXLK_TO_DEV(mxlk), zc->sgt.sgl, zc->sgt.orig_nents,
+                     DMA_TO_DEVICE);
     }
-    mxlk_all_chrdev_cleanup(mxlk);
-    mx_boot_cleanup(&mxlk->mx_dev);
-    mxlk_events_cleanup(mxlk);
-    mx_pci_cleanup(&mxlk->mx_dev);
+    if (zc->sgt.sgl) {
+        sg_free_table(&zc->sgt);
+    }
+    if (zc->npages) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+        unpin_user_pages(zc->pages, zc->npages);
+#else
+        int index;
+
+        for (index = 0; index < zc->npages; index++) {
+            put_page(zc->pages[index]);
+        }
+#endif
+    }
+    kvfree(zc->pages);
+    kfree(zc);
 }
 
-static int mxlk_comms_init(struct mxlk *mxlk)
+/* Drops the writer's or the bds' hold, the last one releases the write */
+static void mxlk_zc_put(struct mxlk *mxlk, struct mxlk_zc *zc)
 {
-    int error;
-    int status;
-    DEVICE_ATTR(debug, S_IWUSR | S_IRUGO, mxlk_debug_show, mxlk_debug_store);
-
-    status = mxlk_get_device_status(mxlk);
-    if (status != MXLK_STATUS_RUN) {
-        mx_err("device status not RUNNING (%d)\n", status);
-        error = -EIO;
-        goto error_device_status;
+    if (atomic_dec_and_test(&zc->refs)) {
+        mxlk_zc_release(mxlk, zc);
     }
+}
 
-    error = mxlk_version_check(mxlk);
-    if (error) {
-        goto error_version;
+/*
+ * Pins the pages backing up to length bytes of the current user segment of an
+ * iterator and advances it past them. Returns the bytes pinned, offset is set
+ * to where they start in the first page.
+ * NOTES:
+ *  1) pages held across DMA are pinned (FOLL_PIN) from 5.6 on, kernels before
+ *     that only have plain page references
+ */
+static ssize_t mxlk_zc_pin(struct iov_iter *from, struct page **pages,
+                           size_t length, int npages, size_t *offset)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+    return iov_iter_extract_pages(from, &pages, length, npages, 0, offset);
+#else
+    unsigned long address;
+    int pinned;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,0,0)
+    if (iter_is_ubuf(from)) {
+        address = (unsigned long)from->ubuf + from->iov_offset;
+    } else
+#endif
+    {
+        address = (unsigned long)from->iov->iov_base + from->iov_offset;
+        length = min(length, from->iov->iov_len - from->iov_offset);
     }
 
-    error = mxlk_discover_txrx(mxlk);
-    if (error) {
-        goto error_stream;
+    *offset = offset_in_page(address);
+    npages = min_t(int, npages, DIV_ROUND_UP(*offset + length, PAGE_SIZE));
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+    pinned = pin_user_pages_fast(address & PAGE_MASK, npages, 0, pages);
+#else
+    pinned = get_user_pages_fast(address & PAGE_MASK, npages, 0, pages);
+#endif
+    if (pinned <= 0) {
+        return (pinned) ? pinned : -EFAULT;
     }
 
-    mxlk_interfaces_init(mxlk);
-
-    mxlk_set_host_status(mxlk, MXLK_STATUS_RUN);
-
-    mxlk->debug = dev_attr_debug;
-    device_create_file(&mxlk->pci->dev, &mxlk->debug);
-
-    memset(&mxlk->stats, 0, sizeof(struct mxlk_stats));
-    memset(&mxlk->stats_old, 0, sizeof(struct mxlk_stats));
-
-    mxlk_ring_doorbell(mxlk);
-
-    return 0;
-
-error_stream :
-error_version :
-error_device_status :
-    mx_err("comms failed to init\n");
+    length = min_t(size_t, length, pinned * PAGE_SIZE - *offset);
+    iov_iter_advance(from, length);
 
-    return error;
+    return length;
+#endif
 }
 
-static void mxlk_comms_cleanup(struct mxlk *mxlk)
+/*
+ * Sends up to MXLK_ZC_MAX_LEN bytes of the current user segment of an iterator
+ * straight from its pages. Returns -EAGAIN, with the iterator untouched, if
+ * the buffer could not be pinned or mapped, or is not MXLK_DMA_ALIGNMENT
+ * aligned, in which case the caller falls back to copying it. Otherwise
+ * returns once the device has consumed every descriptor of the write, the link
+ * went down or a fatal signal is pending.
+ * NOTES:
+ *  1) descriptors left behind by a link going down or a fatal signal keep the
+ *     pages until they are reaped, or cancelled by the queue cleanup
+ */
+static ssize_t mxlk_zc_write(struct mxlk_interface *inf,
+                             struct iov_iter *from, u64 stamp)
 {
-    mxlk_set_host_status(mxlk, MXLK_STATUS_UNINIT);
-    mdelay(10);
+    int index, nbds = 0;
+    size_t length, offset;
+    ssize_t written;
+    int error;
+    struct mxlk *mxlk = inf->mxlk;
+    struct mxlk_zc *zc;
+    struct mxlk_buf_desc *bd, *head = NULL, *tail = NULL;
+    struct scatterlist *sg;
 
-    device_remove_file(MXLK_TO_DEV(mxlk), &mxlk->debug);
-    mxlk_interfaces_cleanup(mxlk);
-    mxlk_txrx_cleanup(mxlk);
-    mxlk_list_cleanup(&mxlk->write);
-}
+    if (mxlk->status != MXLK_STATUS_RUN || !mxlk->fragment_size) {
+        return -EAGAIN;
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,0,0)
+    if (!user_backed_iter(from)) {
+        return -EAGAIN;
+    }
+#else
+    if (!iter_is_iovec(from)) {
+        return -EAGAIN;
+    }
+#endif
 
-int mxlk_core_open(struct mxlk_interface *inf)
-{
-    if (inf->opened) {
-        return -EACCES;
+    length = min_t(size_t, iov_iter_count(from), MXLK_ZC_MAX_LEN);
+
+    zc = kzalloc(sizeof(*zc), GFP_KERNEL);
+    if (!zc) {
+        return -EAGAIN;
     }
 
-    inf->opened = 1;
+    zc->pages = kvmalloc_array(DIV_ROUND_UP(length, PAGE_SIZE) + 1,
+                               sizeof(*zc->pages), GFP_KERNEL);
+    if (!zc->pages) {
+        kfree(zc);
+        return -EAGAIN;
+    }
 
-    return 0;
-}
+    written = mxlk_zc_pin(from, zc->pages, length,
+                          DIV_ROUND_UP(length, PAGE_SIZE) + 1, &offset);
+    if (written <= 0) {
+        mx_dbg("failed to pin user pages (%zd)\n", written);
+        goto error;
+    }
+    length = written;
+    zc->npages = DIV_ROUND_UP(offset + length, PAGE_SIZE);
 
-int mxlk_core_close(struct mxlk_interface *inf)
-{
-    if (inf->opened) {
-        inf->opened = 0;
+    /* The device takes buffers at MXLK_DMA_ALIGNMENT only */
+    if (!IS_ALIGNED(offset, MXLK_DMA_ALIGNMENT)) {
+        goto error_revert;
     }
 
-    return 0;
-}
+    if (sg_alloc_table_from_pages(&zc->sgt, zc->pages, zc->npages,
+                                  offset, length, GFP_KERNEL)) {
+        goto error_revert;
+    }
 
-ssize_t mxlk_core_read(struct mxlk_interface *inf, void *buffer, size_t length)
-{
-    struct mxlk *mxlk = inf->mxlk;
-    size_t remaining = length;
-    struct mxlk_buf_desc *bd;
+    zc->nents = dma_map_sg(MXLK_TO_DEV(mxlk), zc->sgt.sgl, zc->sgt.orig_nents,
+                           DMA_TO_DEVICE);
+    if (!zc->nents) {
+        mx_err("failed to map %d user pages\n", zc->npages);
+        goto error_revert;
+    }
 
-    mutex_lock(&inf->rlock);
-    {
-        bd = (inf->partial_read) ? inf->partial_read : mxlk_list_get(&inf->read);
-        while (remaining && bd) {
-            int error;
-            size_t bcopy;
+    /* Split mapped segments into fragments the device side can receive */
+    for_each_sg(zc->sgt.sgl, sg, zc->nents, index) {
+        dma_addr_t phys = sg_dma_address(sg);
+        size_t remaining = sg_dma_len(sg);
 
-            bcopy = min(remaining, bd->length);
-            error = copy_to_user(buffer, bd->data, bcopy);
-            if (error) {
-                mx_err("failed to copy to user %d/%zu\n", error, bcopy);
-                break;
+        while (remaining) {
+            if (!IS_ALIGNED(phys, MXLK_DMA_ALIGNMENT)) {
+                goto error_bds;
             }
+            bd = kzalloc(sizeof(*bd), GFP_KERNEL);
+            if (!bd) {
+                goto error_bds;
+            }
+            bd->length = min(remaining, mxlk->fragment_size);
+            bd->phys = phys;
+            bd->direction = DMA_TO_DEVICE;
+            bd->interface = inf->id;
+            bd->zc = zc;
 
-            buffer += bcopy;
-            remaining -= bcopy;
-            bd->data += bcopy;
-            bd->length -= bcopy;
-
-            mxlk->stats.rx_usr.bytes += bcopy;
-            if (bd->length == 0) {
-                mxlk->stats.rx_usr.pkts++;
-                mxlk_free_rx_bd(mxlk, bd);
-                bd = mxlk_list_get(&inf->read);
+            if (tail) {
+                tail->next = bd;
+            } else {
+                head = bd;
             }
-        }
+            tail = bd;
+            nbds++;
 
-        /* save for next time */
-        inf->partial_read = bd;
+            phys += bd->length;
+            remaining -= bd->length;
+        }
     }
-    mutex_unlock(&inf->rlock);
 
-    return (length - remaining);
-}
+    atomic_set(&zc->pending, nbds);
+    atomic_set(&zc->refs, 2);
 
-ssize_t mxlk_core_write(struct mxlk_interface *inf, void *buffer, size_t length)
-{
-    size_t remaining = length;
-    struct mxlk *mxlk = inf->mxlk;
-    struct mxlk_buf_desc *bd, *head;
+    mxlk_stats_add(mxlk->stats, MXLK_STAT_zc_writes, 1);
+    mxlk_stats_add(mxlk->stats, MXLK_STAT_tx_usr_pkts, nbds);
+    mxlk_stats_add(mxlk->stats, MXLK_STAT_tx_usr_bytes, length);
 
-    mutex_lock(&inf->wlock);
-    {
-        bd = head = mxlk_alloc_tx_bd(mxlk);
-        while (remaining && bd) {
-            int error;
-            size_t bcopy;
+    mxlk_queue_write(inf, head, nbds, stamp);
 
-            bcopy = min(bd->length, remaining);
-            error = copy_from_user(bd->data, buffer, bcopy);
-            if (error) {
-                mx_err("failed to copy from user %d/%zu\n", error, bcopy);
-                break;
-            }
+    /* Pages have to stay pinned and mapped until the device has read them */
+    error = wait_event_killable(mxlk->wr_waitq,
+                                !atomic_read(&zc->pending) ||
+                                (mxlk->status != MXLK_STATUS_RUN));
+    if (!atomic_read(&zc->pending)) {
+        smp_rmb();
+        written = (zc->error) ? zc->error : length;
+    } else {
+        written = (error) ? error : -EIO;
+    }
+    mxlk_zc_put(mxlk, zc);
 
-            buffer += bcopy;
-            remaining -= bcopy;
-            bd->length = bcopy;
-            bd->interface = inf->id;
+    return written;
 
-            mxlk->stats.tx_usr.pkts++;
-            mxlk->stats.tx_usr.bytes += bcopy;
+error_bds:
+    while (head) {
+        bd = head;
+        head = bd->next;
+        kfree(bd);
+    }
 
-            if (remaining) {
-                bd->next = mxlk_alloc_tx_bd(mxlk);
-                bd = bd->next;
-            }
-        }
+error_revert:
+    iov_iter_revert(from, length);
 
-        if (head) {
-            mxlk_list_put(&inf->mxlk->write, head);
-            mxlk_start_tx(mxlk);
-        }
-    }
-    mutex_unlock(&inf->wlock);
+error:
+    mxlk_zc_release(mxlk, zc);
 
-    return (length - remaining);
+    return -EAGAIN;
 }
 
 bool mxlk_core_read_data_available(struct mxlk_interface *inf)
 {
-    size_t bytes, buffers;
-
-    mxlk_list_info(&inf->read, &bytes, &buffers);
-    return (inf->partial_read || (buffers != 0));
+    return mxlk_read_ready(inf, SIZE_MAX);
 }
 
-bool mxlk_core_write_buffer_available(struct mxlk *mxlk)
+bool mxlk_core_write_buffer_available(struct mxlk_interface *inf)
 {
-    size_t bytes, buffers;
+    return mxlk_write_ready(inf, 0);
+}
 
-    mxlk_list_info(&mxlk->tx_pool, &bytes, &buffers);
-    return (buffers != 0);
+size_t mxlk_core_pool_free(struct mxlk_pool *pool)
+{
+    return mxlk_pool_count(pool);
 }
 
 int mxlk_core_reset_dev(struct mxlk *mxlk)
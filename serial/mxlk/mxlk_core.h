@@ -62,48 +62,157 @@ int mxlk_core_open(struct mxlk_interface *inf);
 int mxlk_core_close(struct mxlk_interface *inf);
 
 /*
- * @brief read buffer from mxlk interface
+ * @brief read buffers from mxlk interface
+ * NOTES:
+ *  1) without nowait, blocks until the read low watermark is queued, the
+ *     read timeout expires (-EAGAIN) or a signal arrives (-ERESTARTSYS)
+ *  2) with nowait set, -EAGAIN is returned when no data is ready
+ *  3) returns 0 when no data is queued and the link is down
+ *  4) in datagram mode, returns exactly one message, or fails with -EMSGSIZE
+ *     leaving it queued when it does not fit in the buffers
  *
  * @param[in] inf    - pointer to interface instance
- * @param[in] buffer - pointer to userspace buffer
- * @param[in] length - max bytes to copy into buffer
+ * @param[in] to     - iterator over the userspace buffers to fill
+ * @param[in] nowait - never sleep, used for IOCB_NOWAIT and O_NONBLOCK
  *
  * @return:
- *       0 - success
- *      <0 - linux error code
+ *      >=0 - number of bytes copied
+ *      <0  - linux error code
+ */
+ssize_t mxlk_core_read(struct mxlk_interface *inf, struct iov_iter *to,
+                       bool nowait);
+
+/*
+ * @brief writes buffers to mxlk interface
+ * NOTES:
+ *  1) without nowait, blocks for TX buffers until everything is queued, the
+ *     write timeout expires or a signal arrives, a partial count is returned
+ *     if anything was queued by then, -EAGAIN or -ERESTARTSYS otherwise
+ *  2) with nowait set, -EAGAIN is returned when no TX buffer is free, and
+ *     writes are never sent zero-copy
+ *  3) in datagram mode, the whole write is sent as one message or not at all,
+ *     -EMSGSIZE if it can never fit in the TX pool
+ *
+ * @param[in] inf    - pointer to interface instance
+ * @param[in] from   - iterator over the userspace buffers to copy from
+ * @param[in] nowait - never sleep, used for IOCB_NOWAIT and O_NONBLOCK
+ *
+ * @return:
+ *      >=0 - number of bytes queued
+ *      <0  - linux error code
+ */
+ssize_t mxlk_core_write(struct mxlk_interface *inf, struct iov_iter *from,
+                        bool nowait);
+
+/*
+ * @brief sets the busy poll time of reads on an opened interface
+ * NOTES:
+ *  1) overrides the interface busy poll time until the interface is closed
+ *
+ * @param[in] inf   - pointer to interface instance
+ * @param[in] usecs - max time a read spends polling the RX ring, 0 disables
+ *
+ */
+void mxlk_core_set_busy_poll(struct mxlk_interface *inf, unsigned int usecs);
+
+/*
+ * @brief sets how long blocking reads or writes of an interface wait
+ *
+ * NOTES:
+ *  1) the setting is dropped when the interface is closed
+ *
+ * @param[in] inf   - pointer to interface instance
+ * @param[in] write - true for writes, false for reads
+ * @param[in] msecs - max wait, 0 waits forever
+ *
+ */
+void mxlk_core_set_timeout(struct mxlk_interface *inf, bool write,
+                           unsigned int msecs);
+
+/*
+ * @brief sets the wakeup threshold of blocked reads or writes of an interface
+ *
+ * NOTES:
+ *  1) reads wake once that many bytes are queued, or the read length if lower
+ *  2) writes wake once the TX pool has that many bytes of free buffers
+ *  3) the setting is dropped when the interface is closed
+ *
+ * @param[in] inf   - pointer to interface instance
+ * @param[in] write - true for writes, false for reads
+ * @param[in] bytes - threshold, 0 behaves as 1
+ *
  */
-ssize_t mxlk_core_read(struct mxlk_interface *inf, void *buffer, size_t length);
+void mxlk_core_set_lowat(struct mxlk_interface *inf, bool write,
+                         unsigned int bytes);
 
 /*
- * @brief writes buffer to mxlk interface
+ * @brief switches an interface between stream and datagram mode
+ *
+ * NOTES:
+ *  1) datagram mode needs a link with MXLK_TXRX_FEATURE_MSG_FLAGS
+ *  2) the mode can only change while nothing is queued for reading
+ *  3) the interface goes back to stream mode when closed
  *
  * @param[in] inf    - pointer to interface instance
- * @param[in] buffer - pointer to userspace buffer
- * @param[in] length - length of buffer to copy from
+ * @param[in] enable - true for datagram mode, false for stream mode
  *
  * @return:
  *       0 - success
- *      <0 - linux error code
+ *      <0 - linux error code, -EOPNOTSUPP or -EBUSY
+ */
+int mxlk_core_set_datagram(struct mxlk_interface *inf, bool enable);
+
+/*
+ * @brief enables coalescing of small stream writes of an interface
+ *
+ * NOTES:
+ *  1) the tail fragment of a write is kept back and filled by the following
+ *     writes, it is sent once full, usecs after it was started, on a flush
+ *     or when coalescing is disabled
+ *  2) the setting is dropped, and pending data sent, when the interface is
+ *     closed
+ *
+ * @param[in] inf   - pointer to interface instance
+ * @param[in] usecs - max time written data is held back, 0 disables
+ *
  */
-ssize_t mxlk_core_write(struct mxlk_interface *inf, void *buffer, size_t length);
+void mxlk_core_set_coalesce(struct mxlk_interface *inf, unsigned int usecs);
+
+/*
+ * @brief sends the data held back by write coalescing right away
+ *
+ * @param[in] inf - pointer to interface instance
+ *
+ */
+void mxlk_core_flush(struct mxlk_interface *inf);
 
 /*
  * @brief indicates if there is read data available for a given interface
  *
  * @param[in] inf    - pointer to interface instance
  *
- * @return true if there is data available, false otherwise
+ * @return true if at least the read low watermark is queued, or a message in
+ *         datagram mode, false otherwise
  */
 bool mxlk_core_read_data_available(struct mxlk_interface *inf);
 
 /*
  * @brief indicates if there are available buffers in the TX pool
  *
- * @param[in] mxlk - pointer to mxlk instance
+ * @param[in] inf - pointer to interface instance
+ *
+ * @return true if at least the write low watermark is free, false otherwise
+ */
+bool mxlk_core_write_buffer_available(struct mxlk_interface *inf);
+
+/*
+ * @brief gives the number of buffers currently free in a pool
+ *
+ * @param[in] pool - pointer to pool
  *
- * @return true if there are buffers available, false otherwise
+ * @return number of free buffers
  */
-bool mxlk_core_write_buffer_available(struct mxlk *mxlk);
+size_t mxlk_core_pool_free(struct mxlk_pool *pool);
 
 /*
  * @brief resets the MX device
@@ -27,17 +27,56 @@
  *      either on first boot or after having been reset.
  *    - MXLK_STATUS_DEV: Get the status (MX application image loaded or not) of
  *      the MX device.
+ *    - MXLK_SET_BUSY_POLL: Set the time, in microseconds, a read on this file
+ *      descriptor may spend polling the RX ring itself when no data is queued
+ *      for the interface. 0 disables busy polling, which is the default
+ *      unless set otherwise through the interface's busy_poll sysfs
+ *      attribute. The setting is dropped when the file descriptor is closed.
+ *    - MXLK_SET_RCVTIMEO / MXLK_SET_SNDTIMEO: Set the time, in milliseconds, a
+ *      blocking read / write on this file descriptor waits for data / TX
+ *      buffers. On expiry, the call returns what was transferred so far or
+ *      fails with EAGAIN. 0, the default, waits forever.
+ *    - MXLK_SET_RCVLOWAT / MXLK_SET_SNDLOWAT: Set the number of bytes that must
+ *      be queued for reading / fit in free TX buffers before a blocked read /
+ *      write is woken up and poll() reports POLLIN / POLLOUT. A read never
+ *      waits for more bytes than it asked for. 0, the default, acts as 1.
+ *    - MXLK_SET_DATAGRAM: Non-zero switches the interface to datagram mode:
+ *      each write is sent as one message and each read returns exactly one
+ *      message, failing with EMSGSIZE if the buffer is too small for it.
+ *      Messages are limited to half of the receive pool, 2.5MB with the
+ *      default rx_pool_size: longer writes fail with EMSGSIZE, longer
+ *      received messages are dropped. The ioctl fails with EOPNOTSUPP if the
+ *      device does not support messages, and with EBUSY while data is queued
+ *      for reading. 0 is stream mode, the default.
+ *    - MXLK_SET_COALESCE: Set the time, in microseconds, the last partly
+ *      filled fragment of a stream write may be held back so that following
+ *      small writes are packed into it. It is sent once full, when the time
+ *      expires or on MXLK_FLUSH. 0, the default, sends every write at once.
+ *    - MXLK_FLUSH: Send the data held back by MXLK_SET_COALESCE now.
  *
- * NOTE: These commands can be triggered using the character device of any
- * interface but they have effect on the whole device. Typically, when using the
- * reset command on a given interface, all the other interfaces of the device
- * will be unusable until an MX application is reloaded. */
+ * Reads and writes block unless the file is opened with O_NONBLOCK, in which
+ * case they fail with EAGAIN instead. The per file descriptor settings above
+ * are dropped when the file descriptor is closed.
+ *
+ * NOTE: Except for the per file descriptor settings, these commands can be
+ * triggered using the character device of any interface but they have effect
+ * on the whole device. Typically, when using the reset command on a given
+ * interface, all the other interfaces of the device will be unusable until an
+ * MX application is reloaded. */
 
 /* IOCTL commands IDs. */
 #define IOC_MAGIC 'Z'
 #define MXLK_RESET_DEV      _IO(IOC_MAGIC, 0x80)
 #define MXLK_BOOT_DEV       _IOW(IOC_MAGIC, 0x81, struct mxlk_boot_param)
 #define MXLK_STATUS_DEV     _IOR(IOC_MAGIC, 0x82, enum mxlk_fw_status)
+#define MXLK_SET_BUSY_POLL  _IOW(IOC_MAGIC, 0x83, unsigned int)
+#define MXLK_SET_RCVTIMEO   _IOW(IOC_MAGIC, 0x84, unsigned int)
+#define MXLK_SET_SNDTIMEO   _IOW(IOC_MAGIC, 0x85, unsigned int)
+#define MXLK_SET_RCVLOWAT   _IOW(IOC_MAGIC, 0x86, unsigned int)
+#define MXLK_SET_SNDLOWAT   _IOW(IOC_MAGIC, 0x87, unsigned int)
+#define MXLK_SET_DATAGRAM   _IOW(IOC_MAGIC, 0x88, unsigned int)
+#define MXLK_SET_COALESCE   _IOW(IOC_MAGIC, 0x89, unsigned int)
+#define MXLK_FLUSH          _IO(IOC_MAGIC, 0x8a)
 
 struct mxlk_boot_param {
     /* Buffer containing the MX application image (MVCMD format). */
@@ -0,0 +1,341 @@
+/*******************************************************************************
+ *
+ * Intel Myriad-X PCIe Serial Driver: Latency histograms
+ *
+ * Copyright (C) 2018 - 2019 Intel Corporation
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ ******************************************************************************/
+
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "mxlk.h"
+#include "mxlk_latency.h"
+
+#define MXLK_LAT_NAME(name) #name,
+
+static const char *mxlk_latency_names[] = {
+    MXLK_LATENCIES(MXLK_LAT_NAME)
+};
+
+/* Percentiles reported, in per 10000 */
+static const u32 mxlk_latency_pcts[] = {5000, 9000, 9900, 9990};
+static const char *mxlk_latency_pct_names[] = {"p50", "p90", "p99", "p999"};
+
+static struct dentry *mxlk_debugfs_root;
+
+static u64 mxlk_latency_bucket_max(int bucket)
+{
+    int group = bucket >> MXLK_LAT_SUB_BITS;
+    u64 sub = bucket & (MXLK_LAT_SUB - 1);
+
+    if (bucket < MXLK_LAT_SUB) {
+        return bucket;
+    }
+    if (bucket == MXLK_LAT_BUCKETS - 1) {
+        return U64_MAX;
+    }
+
+    return ((MXLK_LAT_SUB + sub + 1) << (group - 1)) - 1;
+}
+
+static u64 mxlk_latency_bucket_min(int bucket)
+{
+    return bucket ? mxlk_latency_bucket_max(bucket - 1) + 1 : 0;
+}
+
+/*
+ * Sums the per CPU histograms of an interface into hist. Called with
+ * stats_lock held, which also covers the snapshot buffer.
+ */
+static void mxlk_latency_read_raw(struct mxlk_interface *inf,
+                                  struct mxlk_latency_hist *hist)
+{
+    int cpu;
+    unsigned int start;
+    struct mxlk_pcpu_latency *l;
+    struct mxlk_latency_hist *snap = inf->latency_snap;
+    u64 *total = (u64 *) hist;
+    u64 *value = (u64 *) snap;
+    size_t index, num = sizeof(*hist) / sizeof(u64);
+
+    memset(hist, 0, sizeof(*hist));
+
+    for_each_possible_cpu(cpu) {
+        l = per_cpu_ptr(inf->latency, cpu);
+        do {
+            start = u64_stats_fetch_begin(&l->syncp);
+            memcpy(snap, &l->hist, sizeof(*snap));
+        } while (u64_stats_fetch_retry(&l->syncp, start));
+
+        for (index = 0; index < num; index++) {
+            total[index] += value[index];
+        }
+    }
+}
+
+/* Histograms relative to the last reset, called with stats_lock held */
+static void mxlk_latency_read(struct mxlk_interface *inf,
+                              struct mxlk_latency_hist *hist)
+{
+    u64 *total = (u64 *) hist;
+    u64 *base = (u64 *) inf->latency_base;
+    size_t index, num = sizeof(*hist) / sizeof(u64);
+
+    mxlk_latency_read_raw(inf, hist);
+    for (index = 0; index < num; index++) {
+        total[index] -= base[index];
+    }
+}
+
+static void mxlk_latency_reset(struct mxlk_interface *inf)
+{
+    mutex_lock(&inf->mxlk->stats_lock);
+    mxlk_latency_read_raw(inf, inf->latency_base);
+    mutex_unlock(&inf->mxlk->stats_lock);
+}
+
+static void mxlk_latency_summary(struct seq_file *s, const char *prefix,
+                                 struct mxlk_latency_hist *hist)
+{
+    int lat, bucket, pct;
+    u64 count, seen, target, max;
+
+    for (lat = 0; lat < MXLK_LAT_NUM; lat++) {
+        count = 0;
+        max = 0;
+        for (bucket = 0; bucket < MXLK_LAT_BUCKETS; bucket++) {
+            if (hist->buckets[lat][bucket]) {
+                count += hist->buckets[lat][bucket];
+                max = mxlk_latency_bucket_max(bucket);
+            }
+        }
+
+        seq_printf(s, "%s%-9s count %llu", prefix, mxlk_latency_names[lat],
+                   count);
+        if (!count) {
+            seq_printf(s, "\n");
+            continue;
+        }
+        seq_printf(s, " mean %llu", div64_u64(hist->sum[lat], count));
+
+        /* Percentiles are reported as the upper bound of their bucket */
+        bucket = 0;
+        seen = 0;
+        for (pct = 0; pct < ARRAY_SIZE(mxlk_latency_pcts); pct++) {
+            target = div64_u64(count * mxlk_latency_pcts[pct] + 9999, 10000);
+            while (seen + hist->buckets[lat][bucket] < target) {
+                seen += hist->buckets[lat][bucket];
+                bucket++;
+            }
+            seq_printf(s, " %s %llu", mxlk_latency_pct_names[pct],
+                       mxlk_latency_bucket_max(bucket));
+        }
+        seq_printf(s, " max %llu\n", max);
+    }
+}
+
+static int mxlk_latency_inf_show(struct seq_file *s, void *data)
+{
+    struct mxlk_interface *inf = s->private;
+    struct mxlk_latency_hist *hist;
+    int lat, bucket;
+
+    hist = kmalloc(sizeof(*hist), GFP_KERNEL);
+    if (!hist) {
+        return -ENOMEM;
+    }
+
+    mutex_lock(&inf->mxlk->stats_lock);
+    mxlk_latency_read(inf, hist);
+    mutex_unlock(&inf->mxlk->stats_lock);
+
+    seq_printf(s, "latency in ns, since last reset\n");
+    mxlk_latency_summary(s, "", hist);
+
+    for (lat = 0; lat < MXLK_LAT_NUM; lat++) {
+        seq_printf(s, "\n%s\n", mxlk_latency_names[lat]);
+        for (bucket = 0; bucket < MXLK_LAT_BUCKETS; bucket++) {
+            if (hist->buckets[lat][bucket]) {
+                seq_printf(s, "%llu-%llu %llu\n",
+                           mxlk_latency_bucket_min(bucket),
+                           mxlk_latency_bucket_max(bucket),
+                           hist->buckets[lat][bucket]);
+            }
+        }
+    }
+
+    kfree(hist);
+
+    return 0;
+}
+
+static int mxlk_latency_dev_show(struct seq_file *s, void *data)
+{
+    struct mxlk *mxlk = s->private;
+    struct mxlk_latency_hist *hist, *total;
+    u64 *src, *dst;
+    size_t index, num = sizeof(*hist) / sizeof(u64);
+    int id;
+    char prefix[16];
+
+    hist = kmalloc(sizeof(*hist), GFP_KERNEL);
+    total = kzalloc(sizeof(*total), GFP_KERNEL);
+    if (!hist || !total) {
+        kfree(hist);
+        kfree(total);
+        return -ENOMEM;
+    }
+
+    seq_printf(s, "latency in ns, since last reset\n");
+
+    mutex_lock(&mxlk->stats_lock);
+    for (id = 0; id < MXLK_NUM_INTERFACES; id++) {
+        mxlk_latency_read(mxlk->interfaces + id, hist);
+        src = (u64 *) hist;
+        dst = (u64 *) total;
+        for (index = 0; index < num; index++) {
+            dst[index] += src[index];
+        }
+        scnprintf(prefix, sizeof(prefix), "if%d ", id);
+        mxlk_latency_summary(s, prefix, hist);
+    }
+    mutex_unlock(&mxlk->stats_lock);
+
+    mxlk_latency_summary(s, "dev ", total);
+
+    kfree(hist);
+    kfree(total);
+
+    return 0;
+}
+
+static int mxlk_latency_inf_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, mxlk_latency_inf_show, inode->i_private);
+}
+
+static int mxlk_latency_dev_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, mxlk_latency_dev_show, inode->i_private);
+}
+
+/* Any write resets the histograms of the file */
+static ssize_t mxlk_latency_inf_write(struct file *file, const char __user *buf,
+                                      size_t count, loff_t *ppos)
+{
+    struct seq_file *s = file->private_data;
+
+    mxlk_latency_reset(s->private);
+
+    return count;
+}
+
+static ssize_t mxlk_latency_dev_write(struct file *file, const char __user *buf,
+                                      size_t count, loff_t *ppos)
+{
+    struct seq_file *s = file->private_data;
+    struct mxlk *mxlk = s->private;
+    int id;
+
+    for (id = 0; id < MXLK_NUM_INTERFACES; id++) {
+        mxlk_latency_reset(mxlk->interfaces + id);
+    }
+
+    return count;
+}
+
+static const struct file_operations mxlk_latency_inf_fops = {
+    .owner   = THIS_MODULE,
+    .open    = mxlk_latency_inf_open,
+    .read    = seq_read,
+    .write   = mxlk_latency_inf_write,
+    .llseek  = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations mxlk_latency_dev_fops = {
+    .owner   = THIS_MODULE,
+    .open    = mxlk_latency_dev_open,
+    .read    = seq_read,
+    .write   = mxlk_latency_dev_write,
+    .llseek  = seq_lseek,
+    .release = single_release,
+};
+
+void mxlk_latency_module_init(void)
+{
+    mxlk_debugfs_root = debugfs_create_dir(MXLK_DRIVER_NAME, NULL);
+}
+
+void mxlk_latency_module_exit(void)
+{
+    debugfs_remove_recursive(mxlk_debugfs_root);
+    mxlk_debugfs_root = NULL;
+}
+
+int mxlk_latency_init(struct mxlk *mxlk)
+{
+    int id, cpu;
+    char name[16];
+    struct dentry *dir;
+    struct mxlk_interface *inf;
+
+    for (id = 0; id < MXLK_NUM_INTERFACES; id++) {
+        inf = mxlk->interfaces + id;
+
+        inf->latency_base = kzalloc(sizeof(*inf->latency_base), GFP_KERNEL);
+        inf->latency_snap = kmalloc(sizeof(*inf->latency_snap), GFP_KERNEL);
+        inf->latency = alloc_percpu(struct mxlk_pcpu_latency);
+        if (!inf->latency || !inf->latency_base || !inf->latency_snap) {
+            mxlk_latency_cleanup(mxlk);
+            return -ENOMEM;
+        }
+        for_each_possible_cpu(cpu) {
+            u64_stats_init(&per_cpu_ptr(inf->latency, cpu)->syncp);
+        }
+    }
+
+    if (IS_ERR_OR_NULL(mxlk_debugfs_root)) {
+        return 0;
+    }
+
+    mxlk->debugfs = debugfs_create_dir(mxlk->name, mxlk_debugfs_root);
+    if (IS_ERR_OR_NULL(mxlk->debugfs)) {
+        mx_info("no debugfs, latency histograms not exported\n");
+        mxlk->debugfs = NULL;
+        return 0;
+    }
+
+    debugfs_create_file("latency", S_IWUSR | S_IRUGO, mxlk->debugfs, mxlk,
+                        &mxlk_latency_dev_fops);
+    for (id = 0; id < MXLK_NUM_INTERFACES; id++) {
+        scnprintf(name, sizeof(name), "interface%d", id);
+        dir = debugfs_create_dir(name, mxlk->debugfs);
+        debugfs_create_file("latency", S_IWUSR | S_IRUGO, dir,
+                            mxlk->interfaces + id, &mxlk_latency_inf_fops);
+    }
+
+    return 0;
+}
+
+void mxlk_latency_cleanup(struct mxlk *mxlk)
+{
+    int id;
+
+    debugfs_remove_recursive(mxlk->debugfs);
+    mxlk->debugfs = NULL;
+
+    for (id = 0; id < MXLK_NUM_INTERFACES; id++) {
+        free_percpu(mxlk->interfaces[id].latency);
+        mxlk->interfaces[id].latency = NULL;
+        kfree(mxlk->interfaces[id].latency_base);
+        mxlk->interfaces[id].latency_base = NULL;
+        kfree(mxlk->interfaces[id].latency_snap);
+        mxlk->interfaces[id].latency_snap = NULL;
+    }
+}
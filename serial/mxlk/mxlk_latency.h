@@ -0,0 +1,153 @@
+/*******************************************************************************
+ *
+ * Intel Myriad-X PCIe Serial Driver: Latency histograms
+ *
+ * Copyright (C) 2018 - 2019 Intel Corporation
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ ******************************************************************************/
+
+#ifndef SERIAL_MXLK_MXLK_LATENCY_H_
+#define SERIAL_MXLK_MXLK_LATENCY_H_
+
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+
+struct mxlk;
+
+/*
+ * Intervals between the timestamps a buf desc collects on its way through
+ * the driver:
+ *  tx_queue  - write() entry to TX descriptor post
+ *  tx_device - TX descriptor post to TX reap
+ *  tx_total  - write() entry to TX reap
+ *  rx_read   - RX reap to read() copy-out
+ */
+#define MXLK_LATENCIES(X)       \
+    X(tx_queue)                 \
+    X(tx_device)                \
+    X(tx_total)                 \
+    X(rx_read)
+
+#define MXLK_LAT_ENUM(name) MXLK_LAT_##name,
+
+enum mxlk_lat {
+    MXLK_LATENCIES(MXLK_LAT_ENUM)
+    MXLK_LAT_NUM
+};
+
+/*
+ * Log-linear buckets, in ns: values below MXLK_LAT_SUB get a bucket each, then
+ * every power of two is split in MXLK_LAT_SUB linear buckets (12.5% wide).
+ * Values of 2^MXLK_LAT_MAX_BITS ns (~68s) and above share the last bucket.
+ */
+#define MXLK_LAT_SUB_BITS   (3)
+#define MXLK_LAT_SUB        (1 << MXLK_LAT_SUB_BITS)
+#define MXLK_LAT_MAX_BITS   (36)
+#define MXLK_LAT_BUCKETS    ((MXLK_LAT_MAX_BITS - MXLK_LAT_SUB_BITS + 1) * \
+                             MXLK_LAT_SUB)
+
+struct mxlk_latency_hist {
+    u64 buckets[MXLK_LAT_NUM][MXLK_LAT_BUCKETS];
+    u64 sum[MXLK_LAT_NUM];
+};
+
+/* Per CPU histograms of an interface */
+struct mxlk_pcpu_latency {
+    struct mxlk_latency_hist hist;
+    struct u64_stats_sync syncp;
+};
+
+/*
+ * @brief gives the histogram bucket of a latency
+ *
+ * @param[in] ns - latency, in ns
+ *
+ * @return bucket index
+ */
+static inline int mxlk_latency_bucket(u64 ns)
+{
+    int msb;
+
+    if (ns < MXLK_LAT_SUB) {
+        return ns;
+    }
+
+    msb = fls64(ns) - 1;
+    if (msb >= MXLK_LAT_MAX_BITS) {
+        return MXLK_LAT_BUCKETS - 1;
+    }
+
+    return ((msb - MXLK_LAT_SUB_BITS + 1) << MXLK_LAT_SUB_BITS) +
+           ((ns >> (msb - MXLK_LAT_SUB_BITS)) & (MXLK_LAT_SUB - 1));
+}
+
+/*
+ * @brief records a latency on the local CPU, process context only
+ *
+ * NOTES:
+ *  1) stamps taken on another CPU may be marginally ahead of now, those
+ *     intervals count as 0
+ *
+ * @param[in] pcpu  - per CPU histograms of the interface
+ * @param[in] lat   - interval measured
+ * @param[in] start - timestamp at the start of the interval, in ns
+ * @param[in] end   - timestamp at the end of the interval, in ns
+ *
+ */
+static inline void mxlk_latency_record(struct mxlk_pcpu_latency __percpu *pcpu,
+                                       enum mxlk_lat lat, u64 start, u64 end)
+{
+    struct mxlk_pcpu_latency *l;
+    u64 ns = (end > start) ? (end - start) : 0;
+
+    if (!pcpu) {
+        return;
+    }
+
+    l = get_cpu_ptr(pcpu);
+    u64_stats_update_begin(&l->syncp);
+    l->hist.buckets[lat][mxlk_latency_bucket(ns)]++;
+    l->hist.sum[lat] += ns;
+    u64_stats_update_end(&l->syncp);
+    put_cpu_ptr(pcpu);
+}
+
+/*
+ * @brief creates the driver debugfs directory, called once at module load
+ *
+ */
+void mxlk_latency_module_init(void);
+
+/*
+ * @brief removes the driver debugfs directory, called once at module unload
+ *
+ */
+void mxlk_latency_module_exit(void);
+
+/*
+ * @brief allocates the interface histograms and their debugfs files
+ *
+ * NOTES:
+ *  1) a missing debugfs is not an error, the histograms are still recorded
+ *
+ * @param[in] mxlk - pointer to mxlk instance
+ *
+ * @return:
+ *       0 - success
+ *      <0 - linux error code
+ */
+int mxlk_latency_init(struct mxlk *mxlk);
+
+/*
+ * @brief removes the debugfs files and frees the histograms
+ *
+ * @param[in] mxlk - pointer to mxlk instance
+ *
+ */
+void mxlk_latency_cleanup(struct mxlk *mxlk);
+
+#endif /* SERIAL_MXLK_MXLK_LATENCY_H_ */
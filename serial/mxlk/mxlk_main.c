@@ -11,6 +11,9 @@
 #include "mxlk.h"
 #include "mxlk_char.h"
 #include "mxlk_core.h"
+#ifdef MXLK_BENCH
+#include "mxlk_bench.h"
+#endif
 
 static const struct pci_device_id mxlk_pci_table[] = {
     {PCI_DEVICE(PCI_VENDOR_ID_INTEL, MX_PCI_DEVICE_ID), 0},
@@ -68,6 +71,11 @@ static int __init mxlk_init_module(void)
     }
 
     mxlk_chrdev_init();
+    mxlk_latency_module_init();
+
+#ifdef MXLK_BENCH
+    mxlk_bench_run();
+#endif
 
     return pci_register_driver(&mxlk_driver);
 }
@@ -76,6 +84,7 @@ static void __exit mxlk_exit_module(void)
 {
     mx_dbg(" Exiting driver ...\n");
     pci_unregister_driver(&mxlk_driver);
+    mxlk_latency_module_exit();
     mxlk_chrdev_exit();
 }
 
@@ -0,0 +1,285 @@
+/*******************************************************************************
+ *
+ * Intel Myriad-X PCIe Serial Driver: Lock-free buffer descriptor queues
+ *
+ * Copyright (C) 2018 - 2019 Intel Corporation
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ ******************************************************************************/
+
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/atomic.h>
+
+#include "mxlk_ring.h"
+
+int mxlk_ring_init(struct mxlk_ring *ring, size_t size)
+{
+    unsigned long index;
+
+    size = roundup_pow_of_two(max_t(size_t, size, 2));
+
+    ring->slots = kvmalloc_array(size, sizeof(*ring->slots), GFP_KERNEL);
+    if (!ring->slots) {
+        return -ENOMEM;
+    }
+
+    for (index = 0; index < size; index++) {
+        ring->slots[index].seq = index;
+        ring->slots[index].bd = NULL;
+    }
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+
+    return 0;
+}
+
+void mxlk_ring_cleanup(struct mxlk_ring *ring)
+{
+    kvfree(ring->slots);
+    ring->slots = NULL;
+    ring->mask = 0;
+}
+
+int mxlk_ring_push(struct mxlk_ring *ring, struct mxlk_buf_desc *bd)
+{
+    struct mxlk_ring_slot *slot;
+    unsigned long pos, seq, old;
+    long diff;
+
+    if (unlikely(!ring->slots)) {
+        return -ENOSPC;
+    }
+
+    pos = READ_ONCE(ring->tail);
+    for (;;) {
+        slot = ring->slots + (pos & ring->mask);
+        seq  = smp_load_acquire(&slot->seq);
+        diff = (long) (seq - pos);
+
+        if (diff == 0) {
+            /* slot free for this lap: claim it */
+            old = cmpxchg(&ring->tail, pos, pos + 1);
+            if (old == pos) {
+                break;
+            }
+            pos = old;
+        } else if (diff < 0) {
+            /* slot still holds the previous lap: full */
+            return -ENOSPC;
+        } else {
+            /* another producer claimed it first */
+            pos = READ_ONCE(ring->tail);
+        }
+    }
+
+    slot->bd = bd;
+    smp_store_release(&slot->seq, pos + 1);
+
+    return 0;
+}
+
+struct mxlk_buf_desc *mxlk_ring_pop(struct mxlk_ring *ring)
+{
+    struct mxlk_ring_slot *slot;
+    struct mxlk_buf_desc *bd;
+    unsigned long pos, seq, old;
+    long diff;
+
+    if (unlikely(!ring->slots)) {
+        return NULL;
+    }
+
+    pos = READ_ONCE(ring->head);
+    for (;;) {
+        slot = ring->slots + (pos & ring->mask);
+        seq  = smp_load_acquire(&slot->seq);
+        diff = (long) (seq - (pos + 1));
+
+        if (diff == 0) {
+            /* slot filled for this lap: claim it */
+            old = cmpxchg(&ring->head, pos, pos + 1);
+            if (old == pos) {
+                break;
+            }
+            pos = old;
+        } else if (diff < 0) {
+            /* slot not filled yet: empty */
+            return NULL;
+        } else {
+            /* another consumer claimed it first */
+            pos = READ_ONCE(ring->head);
+        }
+    }
+
+    bd = slot->bd;
+    /* hand the slot over to the producer of the next lap */
+    smp_store_release(&slot->seq, pos + ring->mask + 1);
+
+    return bd;
+}
+
+int mxlk_ring_push_bulk(struct mxlk_ring *ring, struct mxlk_buf_desc **bds,
+                        int count)
+{
+    struct mxlk_ring_slot *slot;
+    unsigned long pos, old;
+    int index, free;
+
+    if (unlikely(!ring->slots)) {
+        return 0;
+    }
+
+    pos = READ_ONCE(ring->tail);
+    for (;;) {
+        /* Only slots already released for this lap can be claimed, and
+         * once the tail is moved past them no one else can touch them */
+        for (free = 0; free < count; free++) {
+            slot = ring->slots + ((pos + free) & ring->mask);
+            if (smp_load_acquire(&slot->seq) != pos + free) {
+                break;
+            }
+        }
+        if (!free) {
+            return 0;
+        }
+
+        old = cmpxchg(&ring->tail, pos, pos + free);
+        if (old == pos) {
+            break;
+        }
+        pos = old;
+    }
+
+    for (index = 0; index < free; index++) {
+        slot = ring->slots + ((pos + index) & ring->mask);
+        slot->bd = bds[index];
+        smp_store_release(&slot->seq, pos + index + 1);
+    }
+
+    return free;
+}
+
+int mxlk_ring_pop_bulk(struct mxlk_ring *ring, struct mxlk_buf_desc **bds,
+                       int count)
+{
+    struct mxlk_ring_slot *slot;
+    unsigned long pos, old;
+    int index, filled;
+
+    if (unlikely(!ring->slots)) {
+        return 0;
+    }
+
+    pos = READ_ONCE(ring->head);
+    for (;;) {
+        for (filled = 0; filled < count; filled++) {
+            slot = ring->slots + ((pos + filled) & ring->mask);
+            if (smp_load_acquire(&slot->seq) != pos + filled + 1) {
+                break;
+            }
+        }
+        if (!filled) {
+            return 0;
+        }
+
+        old = cmpxchg(&ring->head, pos, pos + filled);
+        if (old == pos) {
+            break;
+        }
+        pos = old;
+    }
+
+    for (index = 0; index < filled; index++) {
+        slot = ring->slots + ((pos + index) & ring->mask);
+        bds[index] = slot->bd;
+        smp_store_release(&slot->seq, pos + index + ring->mask + 1);
+    }
+
+    return filled;
+}
+
+size_t mxlk_ring_count(struct mxlk_ring *ring)
+{
+    unsigned long head = READ_ONCE(ring->head);
+    unsigned long tail = READ_ONCE(ring->tail);
+    long count = (long) (tail - head);
+
+    return clamp_t(long, count, 0, ring->mask + 1);
+}
+
+int mxlk_spsc_init(struct mxlk_spsc *ring, size_t size)
+{
+    size = roundup_pow_of_two(max_t(size_t, size, 2));
+
+    ring->bds = kvmalloc_array(size, sizeof(*ring->bds), GFP_KERNEL);
+    if (!ring->bds) {
+        return -ENOMEM;
+    }
+
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+
+    return 0;
+}
+
+void mxlk_spsc_cleanup(struct mxlk_spsc *ring)
+{
+    kvfree(ring->bds);
+    ring->bds = NULL;
+    ring->mask = 0;
+}
+
+int mxlk_spsc_push(struct mxlk_spsc *ring, struct mxlk_buf_desc *bd)
+{
+    unsigned long tail = ring->tail;
+    unsigned long head = smp_load_acquire(&ring->head);
+
+    if (unlikely(!ring->bds) || (tail - head > ring->mask)) {
+        return -ENOSPC;
+    }
+
+    ring->bds[tail & ring->mask] = bd;
+    /* publish the bd before the new tail */
+    smp_store_release(&ring->tail, tail + 1);
+
+    return 0;
+}
+
+struct mxlk_buf_desc *mxlk_spsc_pop(struct mxlk_spsc *ring)
+{
+    struct mxlk_buf_desc *bd;
+    unsigned long head = ring->head;
+    unsigned long tail = smp_load_acquire(&ring->tail);
+
+    if (unlikely(!ring->bds) || (head == tail)) {
+        return NULL;
+    }
+
+    bd = ring->bds[head & ring->mask];
+    /* release the slot only once the bd has been read */
+    smp_store_release(&ring->head, head + 1);
+
+    return bd;
+}
+
+struct mxlk_buf_desc *mxlk_spsc_peek(struct mxlk_spsc *ring)
+{
+    unsigned long head = ring->head;
+    unsigned long tail = smp_load_acquire(&ring->tail);
+
+    if (unlikely(!ring->bds) || (head == tail)) {
+        return NULL;
+    }
+
+    return ring->bds[head & ring->mask];
+}
+
+size_t mxlk_spsc_count(struct mxlk_spsc *ring)
+{
+    return READ_ONCE(ring->tail) - READ_ONCE(ring->head);
+}
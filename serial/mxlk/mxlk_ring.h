@@ -0,0 +1,188 @@
+/*******************************************************************************
+ *
+ * Intel Myriad-X PCIe Serial Driver: Lock-free buffer descriptor queues
+ *
+ * Copyright (C) 2018 - 2019 Intel Corporation
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ ******************************************************************************/
+
+#ifndef SERIAL_MXLK_MXLK_RING_H_
+#define SERIAL_MXLK_MXLK_RING_H_
+
+#include <linux/kernel.h>
+#include <linux/cache.h>
+
+struct mxlk_buf_desc;
+
+/*
+ * Bounded queue safe for any number of concurrent producers and consumers
+ * NOTES:
+ *  1) each slot carries a sequence number telling whether it is free for the
+ *     producer of a given lap or holds a bd for the consumer of that lap, so
+ *     producers and consumers only contend on their own index
+ *  2) used for the buffer pools (multi producer/consumer) and the interface
+ *     read queues (multi producer from RX queues, single consumer reader)
+ *  3) a ring not allocated yet, or already cleaned up, is both empty and full
+ */
+struct mxlk_ring_slot {
+    unsigned long seq;
+    struct mxlk_buf_desc *bd;
+};
+
+struct mxlk_ring {
+    struct mxlk_ring_slot *slots;
+    unsigned long mask;
+    unsigned long head ____cacheline_aligned_in_smp;    /* next to pop */
+    unsigned long tail ____cacheline_aligned_in_smp;    /* next to push */
+};
+
+/*
+ * Bounded queue for exactly one producer and one consumer at a time
+ * NOTES:
+ *  1) used for the per interface write queues of each TX queue: writers of an
+ *     interface are serialized by its write lock, the ring by the TX lock
+ */
+struct mxlk_spsc {
+    struct mxlk_buf_desc **bds;
+    unsigned long mask;
+    unsigned long head ____cacheline_aligned_in_smp;    /* consumer owned */
+    unsigned long tail ____cacheline_aligned_in_smp;    /* producer owned */
+};
+
+/*
+ * @brief allocates a ring able to hold at least size bds
+ *
+ * @param[in] ring - pointer to ring
+ * @param[in] size - minimum capacity, rounded up to a power of 2
+ *
+ * @return:
+ *       0 - success
+ *      <0 - linux error code
+ */
+int mxlk_ring_init(struct mxlk_ring *ring, size_t size);
+
+/*
+ * @brief frees ring storage, bds still queued are not freed
+ *
+ * @param[in] ring - pointer to ring
+ *
+ */
+void mxlk_ring_cleanup(struct mxlk_ring *ring);
+
+/*
+ * @brief queues a bd at the tail of the ring
+ *
+ * @param[in] ring - pointer to ring
+ * @param[in] bd   - bd to queue
+ *
+ * @return:
+ *       0 - success
+ *      <0 - linux error code, -ENOSPC if ring is full
+ */
+int mxlk_ring_push(struct mxlk_ring *ring, struct mxlk_buf_desc *bd);
+
+/*
+ * @brief dequeues the bd at the head of the ring
+ *
+ * @param[in] ring - pointer to ring
+ *
+ * @return bd, or NULL if ring is empty
+ */
+struct mxlk_buf_desc *mxlk_ring_pop(struct mxlk_ring *ring);
+
+/*
+ * @brief queues up to count bds with a single update of the ring tail
+ *
+ * @param[in] ring  - pointer to ring
+ * @param[in] bds   - bds to queue, in order
+ * @param[in] count - number of bds in bds
+ *
+ * @return number of bds queued, from the start of bds
+ */
+int mxlk_ring_push_bulk(struct mxlk_ring *ring, struct mxlk_buf_desc **bds,
+                        int count);
+
+/*
+ * @brief dequeues up to count bds with a single update of the ring head
+ *
+ * @param[in]  ring  - pointer to ring
+ * @param[out] bds   - dequeued bds
+ * @param[in]  count - max number of bds to dequeue
+ *
+ * @return number of bds dequeued
+ */
+int mxlk_ring_pop_bulk(struct mxlk_ring *ring, struct mxlk_buf_desc **bds,
+                       int count);
+
+/*
+ * @brief number of bds queued, only a snapshot under concurrent use
+ *
+ * @param[in] ring - pointer to ring
+ *
+ * @return number of bds queued
+ */
+size_t mxlk_ring_count(struct mxlk_ring *ring);
+
+/*
+ * @brief allocates a ring able to hold at least size bds
+ *
+ * @param[in] ring - pointer to ring
+ * @param[in] size - minimum capacity, rounded up to a power of 2
+ *
+ * @return:
+ *       0 - success
+ *      <0 - linux error code
+ */
+int mxlk_spsc_init(struct mxlk_spsc *ring, size_t size);
+
+/*
+ * @brief frees ring storage, bds still queued are not freed
+ *
+ * @param[in] ring - pointer to ring
+ *
+ */
+void mxlk_spsc_cleanup(struct mxlk_spsc *ring);
+
+/*
+ * @brief queues a bd at the tail of the ring, producer side only
+ *
+ * @param[in] ring - pointer to ring
+ * @param[in] bd   - bd to queue
+ *
+ * @return:
+ *       0 - success
+ *      <0 - linux error code, -ENOSPC if ring is full
+ */
+int mxlk_spsc_push(struct mxlk_spsc *ring, struct mxlk_buf_desc *bd);
+
+/*
+ * @brief dequeues the bd at the head of the ring, consumer side only
+ *
+ * @param[in] ring - pointer to ring
+ *
+ * @return bd, or NULL if ring is empty
+ */
+struct mxlk_buf_desc *mxlk_spsc_pop(struct mxlk_spsc *ring);
+
+/*
+ * @brief returns the bd at the head of the ring without dequeuing it,
+ *        consumer side only
+ *
+ * @param[in] ring - pointer to ring
+ *
+ * @return bd, or NULL if ring is empty
+ */
+struct mxlk_buf_desc *mxlk_spsc_peek(struct mxlk_spsc *ring);
+
+/*
+ * @brief number of bds queued, only a snapshot under concurrent use
+ *
+ * @param[in] ring - pointer to ring
+ *
+ * @return number of bds queued
+ */
+size_t mxlk_spsc_count(struct mxlk_spsc *ring);
+
+#endif /* SERIAL_MXLK_MXLK_RING_H_ */
@@ -0,0 +1,532 @@
+/*******************************************************************************
+ *
+ * Intel Myriad-X PCIe Serial Driver: Statistics
+ *
+ * Copyright (C) 2018 - 2019 Intel Corporation
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ ******************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/sysfs.h>
+#include <linux/device.h>
+
+#include "mxlk.h"
+#include "mxlk_core.h"
+#include "mxlk_stats.h"
+
+#define MXLK_STAT_NAME(name) #name,
+
+static const char *mxlk_stat_names[] = {
+    MXLK_STATS(MXLK_STAT_NAME)
+};
+
+static const char *mxlk_queue_stat_names[] = {
+    MXLK_QUEUE_STATS(MXLK_STAT_NAME)
+};
+
+#define MXLK_DEV_STAT_NAME(name) "dev_" #name,
+
+static const char *mxlk_dev_stat_names[] = {
+    MXLK_DEV_STATS(MXLK_DEV_STAT_NAME)
+};
+
+/*
+ * Values sampled when read instead of counted, exported next to the counters.
+ * Device counters follow as gauges MXLK_GAUGE_NUM and up.
+ */
+enum mxlk_gauge {
+    MXLK_GAUGE_NONE = -1,
+    MXLK_GAUGE_INTERRUPTS,
+    MXLK_GAUGE_RX_POOL_BUFS,
+    MXLK_GAUGE_RX_POOL_FREE,
+    MXLK_GAUGE_TX_POOL_BUFS,
+    MXLK_GAUGE_TX_POOL_FREE,
+    MXLK_GAUGE_READ_BACKLOG,
+    MXLK_GAUGE_WRITE_BACKLOG,
+    MXLK_GAUGE_TX_PAYLOAD,
+    MXLK_GAUGE_MMIO_READS,
+    MXLK_GAUGE_NUM
+};
+
+static const char *mxlk_gauge_names[] = {
+    "interrupts",
+    "rx_pool_bufs",
+    "rx_pool_free",
+    "tx_pool_bufs",
+    "tx_pool_free",
+    "read_backlog",
+    "write_backlog",
+    "tx_payload_permille",
+    "mmio_reads_per_kpkt",
+};
+
+enum mxlk_queue_gauge {
+    MXLK_QGAUGE_TX_RING_USED,
+    MXLK_QGAUGE_RX_RING_USED,
+    MXLK_QGAUGE_WRITE_BACKLOG,
+    MXLK_QGAUGE_NUM
+};
+
+static const char *mxlk_queue_gauge_names[] = {
+    "tx_ring_used",
+    "rx_ring_used",
+    "write_backlog",
+};
+
+struct mxlk_stat_attr {
+    struct device_attribute dattr;
+    struct mxlk *mxlk;
+    struct mxlk_queue *queue;   /* NULL for device files */
+    int stat;                   /* counter, or -1 for a gauge */
+    int gauge;
+};
+
+#define MXLK_STATS_DEV_FILES    (MXLK_STAT_NUM + MXLK_GAUGE_NUM + \
+                                 MXLK_DSTAT_NUM)
+#define MXLK_STATS_QUEUE_FILES  (MXLK_QSTAT_NUM + MXLK_QGAUGE_NUM)
+#define MXLK_STATS_FILES        (MXLK_STATS_DEV_FILES + \
+                                 MXLK_MAX_QUEUES * MXLK_STATS_QUEUE_FILES)
+
+/*
+ * sysfs files: stats/ for the device, queue<N>/ for each possible queue
+ */
+struct mxlk_stats_files {
+    struct mxlk_stat_attr attrs[MXLK_STATS_FILES];
+    struct attribute *ptrs[MXLK_STATS_FILES + 1 + MXLK_MAX_QUEUES];
+    char names[MXLK_MAX_QUEUES][16];
+    struct attribute_group groups[1 + MXLK_MAX_QUEUES];
+    const struct attribute_group *group_ptrs[2 + MXLK_MAX_QUEUES];
+};
+
+void mxlk_stats_read(struct mxlk *mxlk, u64 *stats, u64 *interrupts)
+{
+    int cpu, index;
+    unsigned int start;
+    struct mxlk_pcpu_stats *s;
+    u64 snap[MXLK_STAT_NUM];
+    u64 irqs;
+
+    memset(stats, 0, sizeof(u64) * MXLK_STAT_NUM);
+    *interrupts = 0;
+
+    for_each_possible_cpu(cpu) {
+        s = per_cpu_ptr(mxlk->stats, cpu);
+        do {
+            start = u64_stats_fetch_begin(&s->syncp);
+            memcpy(snap, s->stats, sizeof(snap));
+        } while (u64_stats_fetch_retry(&s->syncp, start));
+        do {
+            start = u64_stats_fetch_begin(&s->irq_syncp);
+            irqs = s->interrupts;
+        } while (u64_stats_fetch_retry(&s->irq_syncp, start));
+
+        for (index = 0; index < MXLK_STAT_NUM; index++) {
+            stats[index] += snap[index];
+        }
+        *interrupts += irqs;
+    }
+}
+
+/* Reads a device counter, torn reads are retried on an upper half change */
+static u64 mxlk_dev_stat_read(struct mxlk_cap_stats *cap, int stat)
+{
+    int offset = offsetof(struct mxlk_cap_stats, dma_to_host_bytes) +
+                 stat * sizeof(u64);
+    u32 low, high, check;
+
+    check = mx_rd32(cap, offset + sizeof(u32));
+    do {
+        high = check;
+        low = mx_rd32(cap, offset);
+        check = mx_rd32(cap, offset + sizeof(u32));
+    } while (check != high);
+
+    return ((u64) high << 32) | low;
+}
+
+bool mxlk_dev_stats_read(struct mxlk *mxlk, u64 *stats)
+{
+    int index, num;
+    struct mxlk_cap_stats *cap = READ_ONCE(mxlk->cap_stats);
+
+    BUILD_BUG_ON(sizeof(struct mxlk_cap_stats) !=
+                 offsetof(struct mxlk_cap_stats, dma_to_host_bytes) +
+                 MXLK_DSTAT_NUM * sizeof(u64));
+
+    memset(stats, 0, sizeof(u64) * MXLK_DSTAT_NUM);
+    if (!cap) {
+        return false;
+    }
+
+    num = min_t(int, READ_ONCE(mxlk->cap_stats_num), MXLK_DSTAT_NUM);
+    for (index = 0; index < num; index++) {
+        stats[index] = mxlk_dev_stat_read(cap, index);
+    }
+
+    return true;
+}
+
+void mxlk_queue_stats_read(struct mxlk_queue *queue, u64 *stats)
+{
+    int cpu, index;
+    unsigned int start;
+    struct mxlk_pcpu_queue_stats *s;
+    u64 snap[MXLK_QSTAT_NUM];
+
+    memset(stats, 0, sizeof(u64) * MXLK_QSTAT_NUM);
+
+    for_each_possible_cpu(cpu) {
+        s = per_cpu_ptr(queue->stats, cpu);
+        do {
+            start = u64_stats_fetch_begin(&s->syncp);
+            memcpy(snap, s->stats, sizeof(snap));
+        } while (u64_stats_fetch_retry(&s->syncp, start));
+
+        for (index = 0; index < MXLK_QSTAT_NUM; index++) {
+            stats[index] += snap[index];
+        }
+    }
+}
+
+static u64 mxlk_stats_sum(struct mxlk *mxlk, struct mxlk_queue *queue,
+                          int stat)
+{
+    int cpu;
+    unsigned int start;
+    u64 value, total = 0;
+
+    for_each_possible_cpu(cpu) {
+        if (queue) {
+            struct mxlk_pcpu_queue_stats *s = per_cpu_ptr(queue->stats, cpu);
+            do {
+                start = u64_stats_fetch_begin(&s->syncp);
+                value = s->stats[stat];
+            } while (u64_stats_fetch_retry(&s->syncp, start));
+        } else {
+            struct mxlk_pcpu_stats *s = per_cpu_ptr(mxlk->stats, cpu);
+            do {
+                start = u64_stats_fetch_begin(&s->syncp);
+                value = s->stats[stat];
+            } while (u64_stats_fetch_retry(&s->syncp, start));
+        }
+        total += value;
+    }
+
+    return total;
+}
+
+static u64 mxlk_queue_backlog(struct mxlk_queue *queue)
+{
+    int index;
+    u64 backlog = 0;
+
+    for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
+        backlog += mxlk_spsc_count(&queue->write[index]);
+    }
+
+    return backlog;
+}
+
+/* Fill of the TX descriptors sent so far, in thousandths of a fragment */
+static u64 mxlk_tx_payload(struct mxlk *mxlk)
+{
+    int index;
+    u64 pkts = 0, bytes = 0;
+    size_t fragment_size = READ_ONCE(mxlk->fragment_size);
+
+    for (index = 0; index < READ_ONCE(mxlk->num_queues); index++) {
+        pkts += mxlk_stats_sum(mxlk, mxlk->queues + index, MXLK_QSTAT_tx_pkts);
+        bytes += mxlk_stats_sum(mxlk, mxlk->queues + index,
+                                MXLK_QSTAT_tx_bytes);
+    }
+
+    if (!pkts || !fragment_size) {
+        return 0;
+    }
+
+    return div64_u64(bytes * 1000, pkts * fragment_size);
+}
+
+/* MMIO reads of ring processing per thousand descriptors handled */
+static u64 mxlk_mmio_reads_per_kpkt(struct mxlk *mxlk)
+{
+    int index;
+    u64 pkts = 0, reads = 0;
+    struct mxlk_queue *queue;
+
+    for (index = 0; index < READ_ONCE(mxlk->num_queues); index++) {
+        queue = mxlk->queues + index;
+        pkts += mxlk_stats_sum(mxlk, queue, MXLK_QSTAT_tx_reaped);
+        pkts += mxlk_stats_sum(mxlk, queue, MXLK_QSTAT_rx_received);
+        reads += mxlk_stats_sum(mxlk, queue, MXLK_QSTAT_mmio_reads);
+    }
+
+    if (!pkts) {
+        return 0;
+    }
+
+    return div64_u64(reads * 1000, pkts);
+}
+
+static u64 mxlk_gauge_read(struct mxlk *mxlk, int gauge)
+{
+    int index;
+    u64 value = 0;
+
+    switch (gauge) {
+        case MXLK_GAUGE_INTERRUPTS:
+            for_each_possible_cpu(index) {
+                struct mxlk_pcpu_stats *s = per_cpu_ptr(mxlk->stats, index);
+                unsigned int start;
+                u64 irqs;
+
+                do {
+                    start = u64_stats_fetch_begin(&s->irq_syncp);
+                    irqs = s->interrupts;
+                } while (u64_stats_fetch_retry(&s->irq_syncp, start));
+                value += irqs;
+            }
+            break;
+        case MXLK_GAUGE_RX_POOL_BUFS:
+            value = atomic_read(&mxlk->rx_pool.total);
+            break;
+        case MXLK_GAUGE_RX_POOL_FREE:
+            value = mxlk_core_pool_free(&mxlk->rx_pool);
+            break;
+        case MXLK_GAUGE_TX_POOL_BUFS:
+            value = atomic_read(&mxlk->tx_pool.total);
+            break;
+        case MXLK_GAUGE_TX_POOL_FREE:
+            value = mxlk_core_pool_free(&mxlk->tx_pool);
+            break;
+        case MXLK_GAUGE_READ_BACKLOG:
+            for (index = 0; index < MXLK_NUM_INTERFACES; index++) {
+                value += mxlk_ring_count(&mxlk->interfaces[index].read);
+            }
+            break;
+        case MXLK_GAUGE_WRITE_BACKLOG:
+            for (index = 0; index < READ_ONCE(mxlk->num_queues); index++) {
+                value += mxlk_queue_backlog(mxlk->queues + index);
+            }
+            break;
+        case MXLK_GAUGE_TX_PAYLOAD:
+            value = mxlk_tx_payload(mxlk);
+            break;
+        case MXLK_GAUGE_MMIO_READS:
+            value = mxlk_mmio_reads_per_kpkt(mxlk);
+            break;
+        default:
+            index = gauge - MXLK_GAUGE_NUM;
+            if ((index >= 0) && (index < MXLK_DSTAT_NUM)) {
+                struct mxlk_cap_stats *cap = READ_ONCE(mxlk->cap_stats);
+
+                if (cap && (index < READ_ONCE(mxlk->cap_stats_num))) {
+                    value = mxlk_dev_stat_read(cap, index);
+                }
+            }
+            break;
+    }
+
+    return value;
+}
+
+static u64 mxlk_queue_gauge_read(struct mxlk *mxlk, struct mxlk_queue *queue,
+                                 int gauge)
+{
+    u32 ndesc, head, tail;
+    struct mxlk_pipe *pipe;
+
+    /* Rings are only mapped while the queue is in use */
+    if (queue->id >= READ_ONCE(mxlk->num_queues)) {
+        return 0;
+    }
+
+    switch (gauge) {
+        case MXLK_QGAUGE_TX_RING_USED:
+            /* posted by the host, not reaped yet */
+            pipe = &queue->tx.pipe;
+            ndesc = pipe->ndesc;
+            /* packed rings have no tail register, the host one is ours */
+            if (pipe->packed) {
+                tail = READ_ONCE(pipe->shadow);
+            } else {
+                tail = mx_rd32(pipe->tail, 0);
+            }
+            head = READ_ONCE(pipe->old);
+            break;
+        case MXLK_QGAUGE_RX_RING_USED:
+            /* filled by the device, not processed yet */
+            pipe = &queue->rx.pipe;
+            /* packed rings tell it only by each descriptor status */
+            if (pipe->packed) {
+                return 0;
+            }
+            ndesc = pipe->ndesc;
+            tail = mx_rd32(pipe->tail, 0);
+            head = mx_rd32(pipe->head, 0);
+            break;
+        case MXLK_QGAUGE_WRITE_BACKLOG:
+            return mxlk_queue_backlog(queue);
+        default:
+            return 0;
+    }
+
+    if (!ndesc || (head >= ndesc) || (tail >= ndesc)) {
+        return 0;
+    }
+
+    return (tail + ndesc - head) % ndesc;
+}
+
+static ssize_t mxlk_stat_show(struct device *dev,
+                              struct device_attribute *attr, char *buf)
+{
+    struct mxlk_stat_attr *sa = container_of(attr, struct mxlk_stat_attr,
+                                             dattr);
+    u64 value;
+
+    if (sa->stat >= 0) {
+        value = mxlk_stats_sum(sa->mxlk, sa->queue, sa->stat);
+    } else if (sa->queue) {
+        value = mxlk_queue_gauge_read(sa->mxlk, sa->queue, sa->gauge);
+    } else {
+        value = mxlk_gauge_read(sa->mxlk, sa->gauge);
+    }
+
+    return scnprintf(buf, PAGE_SIZE, "%llu\n", value);
+}
+
+static void mxlk_stat_attr_init(struct mxlk_stat_attr *sa, struct mxlk *mxlk,
+                                struct mxlk_queue *queue, const char *name,
+                                int stat, int gauge)
+{
+    sysfs_attr_init(&sa->dattr.attr);
+    sa->dattr.attr.name = name;
+    sa->dattr.attr.mode = S_IRUGO;
+    sa->dattr.show = mxlk_stat_show;
+    sa->dattr.store = NULL;
+    sa->mxlk = mxlk;
+    sa->queue = queue;
+    sa->stat = stat;
+    sa->gauge = gauge;
+}
+
+int mxlk_stats_init(struct mxlk *mxlk)
+{
+    int cpu, qid, index, error;
+    struct mxlk_stats_files *files;
+    struct mxlk_stat_attr *sa;
+    struct attribute **ptr;
+
+    mxlk->stats = alloc_percpu(struct mxlk_pcpu_stats);
+    if (!mxlk->stats) {
+        return -ENOMEM;
+    }
+    for_each_possible_cpu(cpu) {
+        u64_stats_init(&per_cpu_ptr(mxlk->stats, cpu)->syncp);
+        u64_stats_init(&per_cpu_ptr(mxlk->stats, cpu)->irq_syncp);
+    }
+
+    for (qid = 0; qid < MXLK_MAX_QUEUES; qid++) {
+        struct mxlk_queue *queue = mxlk->queues + qid;
+
+        queue->id = qid;
+        queue->stats = alloc_percpu(struct mxlk_pcpu_queue_stats);
+        if (!queue->stats) {
+            error = -ENOMEM;
+            goto error;
+        }
+        for_each_possible_cpu(cpu) {
+            u64_stats_init(&per_cpu_ptr(queue->stats, cpu)->syncp);
+        }
+    }
+
+    files = kzalloc(sizeof(*files), GFP_KERNEL);
+    if (!files) {
+        error = -ENOMEM;
+        goto error;
+    }
+
+    sa = files->attrs;
+    ptr = files->ptrs;
+
+    files->groups[0].name = "stats";
+    files->groups[0].attrs = ptr;
+    for (index = 0; index < MXLK_STAT_NUM; index++, sa++) {
+        mxlk_stat_attr_init(sa, mxlk, NULL, mxlk_stat_names[index], index,
+                            MXLK_GAUGE_NONE);
+        *ptr++ = &sa->dattr.attr;
+    }
+    for (index = 0; index < MXLK_GAUGE_NUM; index++, sa++) {
+        mxlk_stat_attr_init(sa, mxlk, NULL, mxlk_gauge_names[index], -1,
+                            index);
+        *ptr++ = &sa->dattr.attr;
+    }
+    for (index = 0; index < MXLK_DSTAT_NUM; index++, sa++) {
+        mxlk_stat_attr_init(sa, mxlk, NULL, mxlk_dev_stat_names[index], -1,
+                            MXLK_GAUGE_NUM + index);
+        *ptr++ = &sa->dattr.attr;
+    }
+    *ptr++ = NULL;
+    files->group_ptrs[0] = &files->groups[0];
+
+    for (qid = 0; qid < MXLK_MAX_QUEUES; qid++) {
+        struct mxlk_queue *queue = mxlk->queues + qid;
+        struct attribute_group *group = &files->groups[1 + qid];
+
+        scnprintf(files->names[qid], sizeof(files->names[qid]), "queue%d", qid);
+        group->name = files->names[qid];
+        group->attrs = ptr;
+        for (index = 0; index < MXLK_QSTAT_NUM; index++, sa++) {
+            mxlk_stat_attr_init(sa, mxlk, queue, mxlk_queue_stat_names[index],
+                                index, MXLK_GAUGE_NONE);
+            *ptr++ = &sa->dattr.attr;
+        }
+        for (index = 0; index < MXLK_QGAUGE_NUM; index++, sa++) {
+            mxlk_stat_attr_init(sa, mxlk, queue, mxlk_queue_gauge_names[index],
+                                -1, index);
+            *ptr++ = &sa->dattr.attr;
+        }
+        *ptr++ = NULL;
+        files->group_ptrs[1 + qid] = group;
+    }
+    files->group_ptrs[1 + MXLK_MAX_QUEUES] = NULL;
+
+    error = sysfs_create_groups(&MXLK_TO_DEV(mxlk)->kobj, files->group_ptrs);
+    if (error) {
+        mx_err("failed to create stats sysfs files (%d)\n", error);
+        kfree(files);
+        goto error;
+    }
+    mxlk->stats_files = files;
+
+    return 0;
+
+error:
+    mxlk_stats_cleanup(mxlk);
+
+    return error;
+}
+
+void mxlk_stats_cleanup(struct mxlk *mxlk)
+{
+    int qid;
+
+    if (mxlk->stats_files) {
+        sysfs_remove_groups(&MXLK_TO_DEV(mxlk)->kobj,
+                            mxlk->stats_files->group_ptrs);
+        kfree(mxlk->stats_files);
+        mxlk->stats_files = NULL;
+    }
+
+    for (qid = 0; qid < MXLK_MAX_QUEUES; qid++) {
+        free_percpu(mxlk->queues[qid].stats);
+        mxlk->queues[qid].stats = NULL;
+    }
+
+    free_percpu(mxlk->stats);
+    mxlk->stats = NULL;
+}
@@ -0,0 +1,219 @@
+/*******************************************************************************
+ *
+ * Intel Myriad-X PCIe Serial Driver: Statistics
+ *
+ * Copyright (C) 2018 - 2019 Intel Corporation
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ ******************************************************************************/
+
+#ifndef SERIAL_MXLK_MXLK_STATS_H_
+#define SERIAL_MXLK_MXLK_STATS_H_
+
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+
+struct mxlk;
+struct mxlk_queue;
+
+/*
+ * Device counters, each exported as stats/<name> in sysfs
+ * NOTES:
+ *  1) names are part of the sysfs ABI, only ever append to these lists
+ */
+#define MXLK_STATS(X)           \
+    X(tx_usr_pkts)              \
+    X(tx_usr_bytes)             \
+    X(rx_usr_pkts)              \
+    X(rx_usr_bytes)             \
+    X(doorbells)                \
+    X(polls)                    \
+    X(poll_budget_exhausted)    \
+    X(busy_polls)               \
+    X(busy_poll_hits)           \
+    X(zc_writes)                \
+    X(zc_fallbacks)             \
+    X(rx_drops_status)          \
+    X(rx_drops_interface)       \
+    X(rx_refill_failures)       \
+    X(read_queue_drops)         \
+    X(write_queue_drops)        \
+    X(pool_drops)               \
+    X(rx_drops_msg)             \
+    X(tx_coalesced)             \
+    X(tx_flushes)
+
+/*
+ * Queue counters, each exported as queue<N>/<name> in sysfs
+ */
+#define MXLK_QUEUE_STATS(X)     \
+    X(tx_pkts)                  \
+    X(tx_bytes)                 \
+    X(rx_pkts)                  \
+    X(rx_bytes)                 \
+    X(tx_event_runs)            \
+    X(rx_event_runs)            \
+    X(tx_reap_runs)             \
+    X(tx_reaped)                \
+    X(rx_runs)                  \
+    X(rx_received)              \
+    X(mmio_reads)
+
+/*
+ * Counters read from the device MXLK_CAP_STATS, each exported as
+ * stats/dev_<name> in sysfs
+ * NOTES:
+ *  1) in the order of struct mxlk_cap_stats
+ */
+#define MXLK_DEV_STATS(X)       \
+    X(dma_to_host_bytes)        \
+    X(dma_from_host_bytes)      \
+    X(desc_stalls)              \
+    X(ring_full)                \
+    X(doorbells)                \
+    X(msis)
+
+#define MXLK_STAT_ENUM(name)  MXLK_STAT_##name,
+#define MXLK_QSTAT_ENUM(name) MXLK_QSTAT_##name,
+#define MXLK_DSTAT_ENUM(name) MXLK_DSTAT_##name,
+
+enum mxlk_stat {
+    MXLK_STATS(MXLK_STAT_ENUM)
+    MXLK_STAT_NUM
+};
+
+enum mxlk_queue_stat {
+    MXLK_QUEUE_STATS(MXLK_QSTAT_ENUM)
+    MXLK_QSTAT_NUM
+};
+
+enum mxlk_dev_stat {
+    MXLK_DEV_STATS(MXLK_DSTAT_ENUM)
+    MXLK_DSTAT_NUM
+};
+
+/*
+ * Per CPU device counters
+ * NOTES:
+ *  1) interrupts is the only counter updated from hard irq context, it has
+ *     its own sync so an irq never nests inside a process context update
+ */
+struct mxlk_pcpu_stats {
+    u64 stats[MXLK_STAT_NUM];
+    struct u64_stats_sync syncp;
+    u64 interrupts;
+    struct u64_stats_sync irq_syncp;
+};
+
+struct mxlk_pcpu_queue_stats {
+    u64 stats[MXLK_QSTAT_NUM];
+    struct u64_stats_sync syncp;
+};
+
+/*
+ * @brief adds to a device counter of the local CPU, process context only
+ *
+ * @param[in] pcpu  - per CPU device counters
+ * @param[in] stat  - counter to update
+ * @param[in] value - value to add
+ *
+ */
+static inline void mxlk_stats_add(struct mxlk_pcpu_stats __percpu *pcpu,
+                                  enum mxlk_stat stat, u64 value)
+{
+    struct mxlk_pcpu_stats *s = get_cpu_ptr(pcpu);
+
+    u64_stats_update_begin(&s->syncp);
+    s->stats[stat] += value;
+    u64_stats_update_end(&s->syncp);
+    put_cpu_ptr(pcpu);
+}
+
+/*
+ * @brief counts an interrupt on the local CPU, hard irq context only
+ *
+ * @param[in] pcpu - per CPU device counters
+ *
+ */
+static inline void mxlk_stats_irq(struct mxlk_pcpu_stats __percpu *pcpu)
+{
+    struct mxlk_pcpu_stats *s = this_cpu_ptr(pcpu);
+
+    u64_stats_update_begin(&s->irq_syncp);
+    s->interrupts++;
+    u64_stats_update_end(&s->irq_syncp);
+}
+
+/*
+ * @brief adds to a queue counter of the local CPU, process context only
+ *
+ * @param[in] pcpu  - per CPU queue counters
+ * @param[in] stat  - counter to update
+ * @param[in] value - value to add
+ *
+ */
+static inline void
+mxlk_queue_stats_add(struct mxlk_pcpu_queue_stats __percpu *pcpu,
+                     enum mxlk_queue_stat stat, u64 value)
+{
+    struct mxlk_pcpu_queue_stats *s = get_cpu_ptr(pcpu);
+
+    u64_stats_update_begin(&s->syncp);
+    s->stats[stat] += value;
+    u64_stats_update_end(&s->syncp);
+    put_cpu_ptr(pcpu);
+}
+
+/*
+ * @brief allocates the device and queue counters and their sysfs files
+ *
+ * @param[in] mxlk - pointer to mxlk instance
+ *
+ * @return:
+ *       0 - success
+ *      <0 - linux error code
+ */
+int mxlk_stats_init(struct mxlk *mxlk);
+
+/*
+ * @brief removes the sysfs files and frees the counters
+ *
+ * @param[in] mxlk - pointer to mxlk instance
+ *
+ */
+void mxlk_stats_cleanup(struct mxlk *mxlk);
+
+/*
+ * @brief sums the device counters over all CPUs
+ *
+ * @param[in]  mxlk       - pointer to mxlk instance
+ * @param[out] stats      - MXLK_STAT_NUM totals
+ * @param[out] interrupts - interrupt total
+ *
+ */
+void mxlk_stats_read(struct mxlk *mxlk, u64 *stats, u64 *interrupts);
+
+/*
+ * @brief sums the counters of a queue over all CPUs
+ *
+ * @param[in]  queue - pointer to queue
+ * @param[out] stats - MXLK_QSTAT_NUM totals
+ *
+ */
+void mxlk_queue_stats_read(struct mxlk_queue *queue, u64 *stats);
+
+/*
+ * @brief reads the counters of the device stats capability
+ * NOTES:
+ *  1) counters are 0 while the device does not expose them
+ *
+ * @param[in]  mxlk  - pointer to mxlk instance
+ * @param[out] stats - MXLK_DSTAT_NUM values
+ *
+ * @return true if the device exposes its counters, false otherwise
+ */
+bool mxlk_dev_stats_read(struct mxlk *mxlk, u64 *stats);
+
+#endif /* SERIAL_MXLK_MXLK_STATS_H_ */
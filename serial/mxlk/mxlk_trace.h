@@ -0,0 +1,160 @@
+/*******************************************************************************
+ *
+ * Intel Myriad-X PCIe Serial Driver: Tracepoints
+ *
+ * Copyright (C) 2018 - 2019 Intel Corporation
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ ******************************************************************************/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mxlk
+
+#if !defined(SERIAL_MXLK_MXLK_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define SERIAL_MXLK_MXLK_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+#include "mxlk.h"
+
+TRACE_EVENT(mxlk_irq,
+    TP_PROTO(struct mxlk *mxlk, int irq),
+    TP_ARGS(mxlk, irq),
+    TP_STRUCT__entry(
+        __field(int, unit)
+        __field(int, irq)
+    ),
+    TP_fast_assign(
+        __entry->unit = mxlk->unit;
+        __entry->irq = irq;
+    ),
+    TP_printk("unit=%d irq=%d", __entry->unit, __entry->irq)
+);
+
+DECLARE_EVENT_CLASS(mxlk_process_start,
+    TP_PROTO(struct mxlk_queue *queue, int budget),
+    TP_ARGS(queue, budget),
+    TP_STRUCT__entry(
+        __field(int, unit)
+        __field(int, queue)
+        __field(int, budget)
+    ),
+    TP_fast_assign(
+        __entry->unit = queue->mxlk->unit;
+        __entry->queue = queue->id;
+        __entry->budget = budget;
+    ),
+    TP_printk("unit=%d queue=%d budget=%d", __entry->unit, __entry->queue,
+              __entry->budget)
+);
+
+DEFINE_EVENT(mxlk_process_start, mxlk_rx_start,
+    TP_PROTO(struct mxlk_queue *queue, int budget),
+    TP_ARGS(queue, budget)
+);
+
+DEFINE_EVENT(mxlk_process_start, mxlk_tx_start,
+    TP_PROTO(struct mxlk_queue *queue, int budget),
+    TP_ARGS(queue, budget)
+);
+
+/* received counts all descriptors handed back, dropped included */
+TRACE_EVENT(mxlk_rx_end,
+    TP_PROTO(struct mxlk_queue *queue, int received, int dropped),
+    TP_ARGS(queue, received, dropped),
+    TP_STRUCT__entry(
+        __field(int, unit)
+        __field(int, queue)
+        __field(int, received)
+        __field(int, dropped)
+    ),
+    TP_fast_assign(
+        __entry->unit = queue->mxlk->unit;
+        __entry->queue = queue->id;
+        __entry->received = received;
+        __entry->dropped = dropped;
+    ),
+    TP_printk("unit=%d queue=%d received=%d dropped=%d", __entry->unit,
+              __entry->queue, __entry->received, __entry->dropped)
+);
+
+TRACE_EVENT(mxlk_tx_end,
+    TP_PROTO(struct mxlk_queue *queue, int reaped, int posted),
+    TP_ARGS(queue, reaped, posted),
+    TP_STRUCT__entry(
+        __field(int, unit)
+        __field(int, queue)
+        __field(int, reaped)
+        __field(int, posted)
+    ),
+    TP_fast_assign(
+        __entry->unit = queue->mxlk->unit;
+        __entry->queue = queue->id;
+        __entry->reaped = reaped;
+        __entry->posted = posted;
+    ),
+    TP_printk("unit=%d queue=%d reaped=%d posted=%d", __entry->unit,
+              __entry->queue, __entry->reaped, __entry->posted)
+);
+
+TRACE_EVENT(mxlk_doorbell,
+    TP_PROTO(struct mxlk *mxlk),
+    TP_ARGS(mxlk),
+    TP_STRUCT__entry(
+        __field(int, unit)
+    ),
+    TP_fast_assign(
+        __entry->unit = mxlk->unit;
+    ),
+    TP_printk("unit=%d", __entry->unit)
+);
+
+/* A pool handed out fewer bds than asked for */
+TRACE_EVENT(mxlk_pool_empty,
+    TP_PROTO(struct mxlk_pool *pool, int requested, int got),
+    TP_ARGS(pool, requested, got),
+    TP_STRUCT__entry(
+        __field(int, unit)
+        __field(int, rx)
+        __field(int, requested)
+        __field(int, got)
+        __field(int, total)
+    ),
+    TP_fast_assign(
+        __entry->unit = pool->mxlk->unit;
+        __entry->rx = (pool->direction == DMA_FROM_DEVICE);
+        __entry->requested = requested;
+        __entry->got = got;
+        __entry->total = atomic_read(&pool->total);
+    ),
+    TP_printk("unit=%d pool=%s requested=%d got=%d total=%d", __entry->unit,
+              __entry->rx ? "rx" : "tx", __entry->requested, __entry->got,
+              __entry->total)
+);
+
+/* RX processing backs off waiting for buffers, queue is -1 for the poller */
+TRACE_EVENT(mxlk_rx_restart,
+    TP_PROTO(struct mxlk *mxlk, int queue, unsigned int delay_ms),
+    TP_ARGS(mxlk, queue, delay_ms),
+    TP_STRUCT__entry(
+        __field(int, unit)
+        __field(int, queue)
+        __field(unsigned int, delay_ms)
+    ),
+    TP_fast_assign(
+        __entry->unit = mxlk->unit;
+        __entry->queue = queue;
+        __entry->delay_ms = delay_ms;
+    ),
+    TP_printk("unit=%d queue=%d delay_ms=%u", __entry->unit, __entry->queue,
+              __entry->delay_ms)
+);
+
+#endif /* SERIAL_MXLK_MXLK_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mxlk_trace
+#include <trace/define_trace.h>
@@ -14,6 +14,9 @@
 #include "mxvp_mmio.h"
 #include "mxvp_queue.h"
 
+#define CREATE_TRACE_POINTS
+#include "mxvp_trace.h"
+
 /* Offsets within the queue's control structure, to match bspec definition */
 #define QCONTROL_START (0x00)
 #define QCONTROL_SIZE  (0x04)
@@ -105,6 +108,8 @@ int mxvp_queue_push(struct mxvp_queue *queue, void *element, size_t length)
     }
     spin_unlock(&queue->lock);
 
+    trace_mxvp_queue_push(queue, length, head, tail, err);
+
     return err;
 }
 
@@ -126,6 +131,7 @@ retry :
         element = kmalloc(length, GFP_ATOMIC);
         if (element) {
             dequeue(queue, head, element, length);
+            trace_mxvp_queue_pull(queue, length, head);
         }
     }
     spin_unlock(&queue->lock);
@@ -0,0 +1,68 @@
+/*******************************************************************************
+ *
+ * Intel Myriad-X Vision Processor Driver: Tracepoints
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ ******************************************************************************/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mxvp
+
+#if !defined(MXVP_TRACE_HEADER_) || defined(TRACE_HEADER_MULTI_READ)
+#define MXVP_TRACE_HEADER_
+
+#include <linux/tracepoint.h>
+
+#include "mxvp_queue.h"
+
+/* head and tail are the queue indices seen before the push */
+TRACE_EVENT(mxvp_queue_push,
+    TP_PROTO(struct mxvp_queue *queue, u32 length, u32 head, u32 tail,
+             int error),
+    TP_ARGS(queue, length, head, tail, error),
+    TP_STRUCT__entry(
+        __field(const void *, queue)
+        __field(u32, length)
+        __field(u32, head)
+        __field(u32, tail)
+        __field(int, error)
+    ),
+    TP_fast_assign(
+        __entry->queue = queue;
+        __entry->length = length;
+        __entry->head = head;
+        __entry->tail = tail;
+        __entry->error = error;
+    ),
+    TP_printk("queue=%p length=%u head=%u tail=%u error=%d", __entry->queue,
+              __entry->length, __entry->head, __entry->tail, __entry->error)
+);
+
+/* Only traced when an element was dequeued, head is its offset */
+TRACE_EVENT(mxvp_queue_pull,
+    TP_PROTO(struct mxvp_queue *queue, u32 length, u32 head),
+    TP_ARGS(queue, length, head),
+    TP_STRUCT__entry(
+        __field(const void *, queue)
+        __field(u32, length)
+        __field(u32, head)
+    ),
+    TP_fast_assign(
+        __entry->queue = queue;
+        __entry->length = length;
+        __entry->head = head;
+    ),
+    TP_printk("queue=%p length=%u head=%u", __entry->queue, __entry->length,
+              __entry->head)
+);
+
+#endif /* MXVP_TRACE_HEADER_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mxvp_trace
+#include <trace/define_trace.h>